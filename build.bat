@@ -22,6 +22,8 @@ if not exist build\Release\lbmcl.exe (
 copy src\lbm.cl build\Release
 copy src\gl_shader\vertex.vert build\Release
 copy src\gl_shader\render.frag build\Release
+copy src\gl_shader\particle.vert build\Release
+copy src\gl_shader\particle.frag build\Release
 copy res\mask.jpg build\Release
 
 echo Build succeeded
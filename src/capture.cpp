@@ -0,0 +1,201 @@
+#include <iostream>
+#include "capture.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+bool FrameCapture::open(const std::string & path, int pWidth, int pHeight, float pFps)
+{
+    width = pWidth;
+    height = pHeight;
+    fps = pFps;
+    y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+
+    if (path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        file = stdout;
+    } else {
+        file = fopen(path.c_str(), "wb");
+    }
+    if (file == NULL) {
+        std::cout << "Unable to open capture file " << path << std::endl;
+        return false;
+    }
+    if (y4m)
+        fprintf(file, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C444\n", width, height, (int)(fps * 1000.0f + 0.5f));
+
+    glGenBuffers(CAPTURE_RING_SIZE, pbo);
+    for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+        fence[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::cout << "capturing " << width << "x" << height << " frames to " << path << std::endl;
+    framesRead = framesMapped = framesDropped = framesSkipped = framesWritten = 0;
+    ticksDue = 0;
+    carriedRepeats = 0;
+    startTime = -1.0;
+    stopping = false;
+    writer = std::thread(&FrameCapture::writerLoop, this);
+    return true;
+}
+
+void FrameCapture::readFrame(int x, int y, double time)
+{
+    // ticks of the file rate up to _time_, the first frame is the first tick
+    if (startTime < 0.0)
+        startTime = time;
+    long long ticks = (long long)((time - startTime) * fps) + 1;
+    if (ticks <= ticksDue) {
+        framesSkipped++;
+        return;
+    }
+
+    // the oldest read is mapped before its buffer is reused
+    if (framesRead - framesMapped == CAPTURE_RING_SIZE - 1)
+        mapFrame();
+
+    int i = framesRead % CAPTURE_RING_SIZE;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    // RGBA8 is the format drivers copy without conversion, into the buffer and not to host
+    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    repeats[i] = (int)(ticks - ticksDue);
+    ticksDue = ticks;
+    framesRead++;
+}
+
+void FrameCapture::mapFrame()
+{
+    int i = framesMapped % CAPTURE_RING_SIZE;
+    // normally signaled already, the read was issued frames ago
+    glClientWaitSync(fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glDeleteSync(fence[i]);
+    fence[i] = 0;
+
+    framesMapped++;
+
+    // drop the frame rather than wait for a writer that falls behind, the next frame
+    // written takes its ticks so that the file keeps its duration
+    int count = repeats[i] + carriedRepeats;
+    carriedRepeats = count;
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        full = frames.size() >= CAPTURE_QUEUE_SIZE;
+    }
+    if (full) {
+        framesDropped++;
+        return;
+    }
+
+    size_t size = (size_t)width * height * 4;
+    std::vector<unsigned char> frame;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+    const unsigned char * data = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (data) {
+        frame.assign(data, data + size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (frame.empty()) {
+        framesDropped++;
+        return;
+    }
+
+    carriedRepeats = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        frames.push_back({ std::move(frame), count });
+    }
+    ready.notify_one();
+}
+
+void FrameCapture::close()
+{
+    if (file == NULL)
+        return;
+
+    while (framesMapped < framesRead)
+        mapFrame();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_one();
+    writer.join();
+
+    glDeleteBuffers(CAPTURE_RING_SIZE, pbo);
+    if (file != stdout)
+        fclose(file);
+    else
+        fflush(file);
+    file = NULL;
+
+    std::cerr << "captured " << framesMapped - framesDropped << " frames as " << framesWritten << " at " << fps
+              << " fps, skipped " << framesSkipped << ", dropped " << framesDropped << std::endl;
+}
+
+void FrameCapture::writerLoop()
+{
+    while (true) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return stopping || !frames.empty(); });
+            if (frames.empty())
+                return;
+            frame = std::move(frames.front());
+            frames.pop_front();
+        }
+        writeFrame(frame.rgba, frame.repeats);
+        framesWritten += frame.repeats;
+    }
+}
+
+void FrameCapture::writeFrame(const std::vector<unsigned char> & rgba, int count)
+{
+    // GL rows are bottom-up, video rows top-down
+    std::vector<unsigned char> out((size_t)width * height * 3);
+    if (y4m) {
+        unsigned char * yPlane = &out[0];
+        unsigned char * uPlane = yPlane + (size_t)width * height;
+        unsigned char * vPlane = uPlane + (size_t)width * height;
+        for (int row = 0; row < height; row++) {
+            const unsigned char * src = &rgba[(size_t)(height - 1 - row) * width * 4];
+            for (int col = 0; col < width; col++) {
+                int r = src[4 * col], g = src[4 * col + 1], b = src[4 * col + 2];
+                size_t o = (size_t)row * width + col;
+                // BT.601 studio range
+                yPlane[o] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                uPlane[o] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                vPlane[o] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+    } else {
+        for (int row = 0; row < height; row++) {
+            const unsigned char * src = &rgba[(size_t)(height - 1 - row) * width * 4];
+            unsigned char * rgb = &out[(size_t)row * width * 3];
+            for (int col = 0; col < width; col++) {
+                rgb[3 * col] = src[4 * col];
+                rgb[3 * col + 1] = src[4 * col + 1];
+                rgb[3 * col + 2] = src[4 * col + 2];
+            }
+        }
+    }
+
+    // converted once, repeated to fill the ticks the frame stood on screen
+    for (int i = 0; i < count; i++) {
+        if (y4m)
+            fputs("FRAME\n", file);
+        fwrite(out.data(), 1, out.size(), file);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+
+#define CAPTURE_RING_SIZE 4         // frames in flight between glReadPixels and mapping
+#define CAPTURE_QUEUE_SIZE 8        // frames waiting for the writer, further frames are dropped
+
+// Records the drawn frames to a YUV4MPEG2 (.y4m, 4:4:4) or raw RGB24 file, or to
+// stdout for "-". glReadPixels goes into a ring of pixel buffer objects that are
+// mapped CAPTURE_RING_SIZE - 1 frames later, when the copy is long done, and a
+// writer thread converts and writes the frames. Frames are drawn at a varying rate,
+// the file has a fixed one: a frame is written as often as ticks of that rate passed
+// since the previous one, and frames drawn within the same tick are skipped.
+// Requires a current GL context on the calling thread for everything but the constructor.
+class FrameCapture
+{
+public:
+    FrameCapture() {}
+    ~FrameCapture() { close(); }
+
+    // start capturing frames of width x height at _fps_ frames per second
+    bool open(const std::string & path, int pWidth, int pHeight, float pFps);
+    bool active() const { return file != NULL; }
+    // queue a read of the width x height rectangle at (x, y) of the current draw
+    // buffer, drawn at _time_ seconds, call after drawing and before swapping
+    void readFrame(int x, int y, double time);
+    // write out the frames in flight and stop the writer
+    void close();
+
+    int width = 0, height = 0;
+
+private:
+    struct Frame {
+        std::vector<unsigned char> rgba;    // bottom-up
+        int repeats;                        // written this many times in a row
+    };
+
+    FILE * file = NULL;
+    bool y4m = false;
+    float fps = 0.0f;
+    double startTime = 0.0;
+    long long ticksDue = 0;                 // frames of the file up to the last read
+    unsigned int pbo[CAPTURE_RING_SIZE];
+    GLsync fence[CAPTURE_RING_SIZE];
+    int repeats[CAPTURE_RING_SIZE];
+    int carriedRepeats = 0;                 // ticks of dropped frames, added to the next one
+    long long framesRead = 0, framesMapped = 0, framesDropped = 0, framesSkipped = 0, framesWritten = 0;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Frame> frames;
+    bool stopping = false;
+
+    void mapFrame();
+    void writerLoop();
+    void writeFrame(const std::vector<unsigned char> & rgba, int count);
+};
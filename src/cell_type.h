@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+// Lattice cell types stored in the 8-bit cell type map.
+// lbm.cl receives the same values as preprocessor definitions, see cellTypeDefines().
+enum CellType : unsigned char {
+    CELL_SOLID = 0,     // bounce-back wall
+    CELL_FLUID = 1,
+    CELL_INLET = 2,     // equilibrium at the prescribed inlet velocity
+    CELL_OUTLET = 3     // equilibrium at the prescribed density
+};
+
+// Classify one RGB mask pixel: saturated red marks inlets, saturated blue
+// marks outlets, otherwise bright pixels are fluid and dark ones solid.
+inline CellType classifyMaskPixel(unsigned char r, unsigned char g, unsigned char b)
+{
+    if (r > 127 && g < 100 && b < 100)
+        return CELL_INLET;
+    if (b > 127 && r < 100 && g < 100)
+        return CELL_OUTLET;
+    return r > 127 ? CELL_FLUID : CELL_SOLID;
+}
+
+// Per-tile summary of the cell type map, one tile per lbm work-group
+enum TileType : unsigned char {
+    TILE_MIXED = 0,     // per-cell checks needed
+    TILE_FLUID = 1,     // every cell is fluid, no boundary checks
+    TILE_SOLID = 2      // tile and its one-cell ring are solid, the tile is never updated
+};
+
+inline std::string cellTypeDefines()
+{
+    return " -DCELL_SOLID=" + std::to_string(CELL_SOLID) +
+           " -DCELL_FLUID=" + std::to_string(CELL_FLUID) +
+           " -DCELL_INLET=" + std::to_string(CELL_INLET) +
+           " -DCELL_OUTLET=" + std::to_string(CELL_OUTLET) +
+           " -DTILE_MIXED=" + std::to_string(TILE_MIXED) +
+           " -DTILE_FLUID=" + std::to_string(TILE_FLUID) +
+           " -DTILE_SOLID=" + std::to_string(TILE_SOLID);
+}
+
+// Layout of the 1-bit fluid bitmap (rows padded to whole 32-bit words) and of
+// the per-tile summary, both built on device by buildOccupancy/summarizeTiles
+struct Occupancy {
+    int pitch = 0;                      // words per bitmap row
+    int tilesX = 0, tilesY = 0;
+    int tileCount[3] = { 0, 0, 0 };     // number of tiles of each TileType
+};
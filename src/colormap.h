@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+
+// Colormaps for the displayed quantity, sampled into lookup tables
+enum Colormap {
+    COLORMAP_VIRIDIS = 0,   // perceptually uniform, for magnitudes
+    COLORMAP_COOLWARM,      // diverging, for signed quantities
+    COLORMAP_GRAYSCALE,
+    COLORMAP_BLUE,          // the original blue tint
+    COLORMAP_COUNT
+};
+
+inline const char * colormapName(int map)
+{
+    static const char * names[COLORMAP_COUNT] = { "viridis", "coolwarm", "grayscale", "blue" };
+    return names[map];
+}
+
+// RGB of _map_ at t in [0, 1], linear between 9 evenly spaced control points
+inline void sampleColormap(int map, float t, float rgb[3])
+{
+    static const float points[COLORMAP_COUNT][9][3] = {
+        {   // viridis
+            { 0.267f, 0.005f, 0.329f }, { 0.278f, 0.176f, 0.482f }, { 0.231f, 0.322f, 0.546f },
+            { 0.172f, 0.448f, 0.558f }, { 0.128f, 0.567f, 0.551f }, { 0.122f, 0.620f, 0.537f },
+            { 0.208f, 0.718f, 0.473f }, { 0.565f, 0.843f, 0.263f }, { 0.993f, 0.906f, 0.144f }
+        },
+        {   // coolwarm
+            { 0.230f, 0.299f, 0.754f }, { 0.348f, 0.466f, 0.888f }, { 0.484f, 0.622f, 0.975f },
+            { 0.619f, 0.744f, 0.999f }, { 0.865f, 0.865f, 0.865f }, { 0.958f, 0.769f, 0.678f },
+            { 0.958f, 0.602f, 0.481f }, { 0.869f, 0.400f, 0.318f }, { 0.706f, 0.016f, 0.150f }
+        },
+        {   // grayscale
+            { 0.000f, 0.000f, 0.000f }, { 0.125f, 0.125f, 0.125f }, { 0.250f, 0.250f, 0.250f },
+            { 0.375f, 0.375f, 0.375f }, { 0.500f, 0.500f, 0.500f }, { 0.625f, 0.625f, 0.625f },
+            { 0.750f, 0.750f, 0.750f }, { 0.875f, 0.875f, 0.875f }, { 1.000f, 1.000f, 1.000f }
+        },
+        {   // blue
+            { 0.000f, 0.000f, 0.000f }, { 0.050f, 0.075f, 0.125f }, { 0.100f, 0.150f, 0.250f },
+            { 0.150f, 0.225f, 0.375f }, { 0.200f, 0.300f, 0.500f }, { 0.250f, 0.375f, 0.625f },
+            { 0.300f, 0.450f, 0.750f }, { 0.350f, 0.525f, 0.875f }, { 0.400f, 0.600f, 1.000f }
+        }
+    };
+
+    float x = std::min(1.0f, std::max(0.0f, t)) * 8.0f;
+    int i = std::min(7, (int)x);
+    float a = x - i;
+    for (int c = 0; c < 3; c++)
+        rgb[c] = points[map][i][c] * (1.0f - a) + points[map][i + 1][c] * a;
+}
+
+// _size_ RGBA8 entries of _map_, as uploaded to the lookup textures
+inline void colormapTable(int map, int size, unsigned char * rgba)
+{
+    for (int i = 0; i < size; i++) {
+        float rgb[3];
+        sampleColormap(map, (float)i / (size - 1), rgb);
+        for (int c = 0; c < 3; c++)
+            rgba[4 * i + c] = (unsigned char)(rgb[c] * 255.0f + 0.5f);
+        rgba[4 * i + 3] = 255;
+    }
+}
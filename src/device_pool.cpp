@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <iostream>
+
+#include "device_pool.h"
+#include "perf_util.h"
+
+size_t DevicePool::sizeClass(size_t bytes)
+{
+    // 8 classes per power of two, at most 12.5% slack
+    size_t step = 256;
+    while (step * 16 <= bytes)
+        step *= 2;
+    return (bytes + step - 1) / step * step;
+}
+
+template <typename T, typename F>
+T DevicePool::allocate(F create)
+{
+    try {
+        return create();
+    } catch(cl::Error err) {
+        if (err.err() != CL_MEM_OBJECT_ALLOCATION_FAILURE && err.err() != CL_OUT_OF_RESOURCES)
+            throw;
+    }
+    trimLocked();
+    return create();
+}
+
+cl::Image2D DevicePool::image2D(cl_mem_flags flags, const cl::ImageFormat & format, int width, int height)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    requests++;
+    for (ImageEntry & e : images) {
+        if (e.flags == flags && e.order == format.image_channel_order && e.type == format.image_channel_data_type &&
+            e.width == width && e.height == height && !e.leased) {
+            e.leased = true;
+            reused++;
+            return e.image;
+        }
+    }
+
+    cl::Image2D image = allocate<cl::Image2D>([&] { return cl::Image2D(context, flags, format, width, height); });
+    size_t bytes = (size_t)width * height * imageElementSize(image);
+    images.push_back({ image, flags, format.image_channel_order, format.image_channel_data_type, width, height, bytes, true });
+    heldBytes += bytes;
+    peakBytes = std::max(peakBytes, heldBytes);
+    return image;
+}
+
+cl::Buffer DevicePool::buffer(cl_mem_flags flags, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    requests++;
+    size_t classBytes = sizeClass(bytes);
+    for (BufferEntry & e : buffers) {
+        if (e.flags == flags && e.bytes == classBytes && !e.leased) {
+            e.leased = true;
+            e.requested = bytes;
+            reused++;
+            return e.buffer;
+        }
+    }
+
+    cl::Buffer buffer = allocate<cl::Buffer>([&] { return cl::Buffer(context, flags, classBytes); });
+    buffers.push_back({ buffer, flags, classBytes, bytes, true });
+    heldBytes += classBytes;
+    peakBytes = std::max(peakBytes, heldBytes);
+    return buffer;
+}
+
+void DevicePool::release(const cl::Memory & mem, bool reuse)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < images.size(); i++) {
+        if (images[i].image() == mem()) {
+            images[i].leased = false;
+            if (!reuse) {
+                heldBytes -= images[i].bytes;
+                images[i] = images.back();
+                images.pop_back();
+            }
+            return;
+        }
+    }
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (buffers[i].buffer() == mem()) {
+            buffers[i].leased = false;
+            if (!reuse) {
+                heldBytes -= buffers[i].bytes;
+                buffers[i] = buffers.back();
+                buffers.pop_back();
+            }
+            return;
+        }
+    }
+}
+
+void DevicePool::trimLocked()
+{
+    for (size_t i = 0; i < images.size();) {
+        if (!images[i].leased) {
+            heldBytes -= images[i].bytes;
+            images[i] = images.back();
+            images.pop_back();
+        } else {
+            i++;
+        }
+    }
+    for (size_t i = 0; i < buffers.size();) {
+        if (!buffers[i].leased) {
+            heldBytes -= buffers[i].bytes;
+            buffers[i] = buffers.back();
+            buffers.pop_back();
+        } else {
+            i++;
+        }
+    }
+}
+
+void DevicePool::trim()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    trimLocked();
+}
+
+DevicePoolStats DevicePool::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    DevicePoolStats s;
+    for (ImageEntry & e : images)
+        (e.leased ? s.liveBytes : s.freeBytes) += e.bytes;
+    for (BufferEntry & e : buffers) {
+        if (!e.leased) {
+            s.freeBytes += e.bytes;
+        } else {
+            s.liveBytes += e.bytes;
+            s.slackBytes += e.bytes - e.requested;
+        }
+    }
+    s.peakBytes = peakBytes;
+    s.requests = requests;
+    s.reused = reused;
+    return s;
+}
+
+void DevicePool::report(const char * name)
+{
+    DevicePoolStats s = stats();
+    double held = (double)(s.liveBytes + s.freeBytes);
+    std::cout << name << ": " << s.liveBytes / (1024 * 1024) << " MB live, " << s.freeBytes / (1024 * 1024)
+              << " MB free, " << s.peakBytes / (1024 * 1024) << " MB peak, " << s.reused << " of " << s.requests
+              << " requests reused, fragmentation " << (held > 0.0 ? 100.0 * s.freeBytes / held : 0.0)
+              << "% free, " << s.slackBytes / 1024 << " KB slack" << std::endl;
+}
+
+DevicePoolLease::~DevicePoolLease()
+{
+    if (pool)
+        for (cl::Memory & mem : held)
+            pool->release(mem, reuse);
+}
+
+cl::Image2D DevicePoolLease::image2D(cl_mem_flags flags, const cl::ImageFormat & format, int width, int height)
+{
+    if (!pool)
+        return cl::Image2D(context, flags, format, width, height);
+    cl::Image2D image = pool->image2D(flags, format, width, height);
+    held.push_back(image);
+    return image;
+}
+
+cl::Buffer DevicePoolLease::buffer(cl_mem_flags flags, size_t bytes)
+{
+    if (!pool)
+        return cl::Buffer(context, flags, bytes);
+    cl::Buffer buffer = pool->buffer(flags, bytes);
+    held.push_back(buffer);
+    return buffer;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+// Usage of a DevicePool, in bytes of device memory
+struct DevicePoolStats {
+    size_t liveBytes = 0;               // held by objects in use
+    size_t freeBytes = 0;               // held by the pool for later requests
+    size_t peakBytes = 0;               // largest live + free so far
+    size_t slackBytes = 0;              // live buffer bytes beyond what was asked for
+    long long requests = 0, reused = 0;
+};
+
+// Device images and buffers of one context, reused by shape. An object handed out is
+// leased until it is given back by release(), usually through a DevicePoolLease; only then
+// does it serve the next request of the same flags and size and format. Buffers are
+// rounded up to size classes an eighth of a power of two apart, so that slightly different
+// sizes share objects. Give objects back only after the queue using them has finished.
+// Host pointer flags are not supported. Thread safe.
+class DevicePool
+{
+public:
+    explicit DevicePool(cl::Context & pContext) : context(pContext) {}
+
+    cl::Image2D image2D(cl_mem_flags flags, const cl::ImageFormat & format, int width, int height);
+    cl::Buffer buffer(cl_mem_flags flags, size_t bytes);
+    // end the lease of an object handed out above; with _reuse_ false the pool drops it
+    // instead, for objects that queued work may still be using
+    void release(const cl::Memory & mem, bool reuse = true);
+    // release the free objects
+    void trim();
+
+    DevicePoolStats stats();
+    // print the usage, with the free share of the held memory as its fragmentation
+    void report(const char * name);
+
+private:
+    struct ImageEntry {
+        cl::Image2D image;
+        cl_mem_flags flags;
+        cl_channel_order order;
+        cl_channel_type type;
+        int width, height;
+        size_t bytes;
+        bool leased;
+    };
+    struct BufferEntry {
+        cl::Buffer buffer;
+        cl_mem_flags flags;
+        size_t bytes, requested;
+        bool leased;
+    };
+
+    cl::Context context;
+    std::mutex mutex;
+    std::vector<ImageEntry> images;
+    std::vector<BufferEntry> buffers;
+    size_t heldBytes = 0, peakBytes = 0;
+    long long requests = 0, reused = 0;
+
+    static size_t sizeClass(size_t bytes);
+    // run _create_, on running out of memory release the free objects and try once more
+    template <typename T, typename F> T allocate(F create);
+    void trimLocked();
+};
+
+// The objects one holder took from a DevicePool, given back together when the lease is
+// destroyed. Without a pool they are plain new objects. Holders copied by value share the
+// lease through a std::shared_ptr. Finish the queue using the objects before dropping the
+// last reference, or call forget() if that failed.
+class DevicePoolLease
+{
+public:
+    DevicePoolLease(cl::Context & pContext, DevicePool * pPool) : context(pContext), pool(pPool) {}
+    ~DevicePoolLease();
+    DevicePoolLease(const DevicePoolLease &) = delete;
+    DevicePoolLease & operator=(const DevicePoolLease &) = delete;
+
+    cl::Image2D image2D(cl_mem_flags flags, const cl::ImageFormat & format, int width, int height);
+    cl::Buffer buffer(cl_mem_flags flags, size_t bytes);
+    // have the pool drop the objects rather than hand them out again
+    void forget() { reuse = false; }
+
+private:
+    cl::Context context;
+    DevicePool * pool;
+    std::vector<cl::Memory> held;
+    bool reuse = true;
+};
@@ -0,0 +1,94 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "display_readback.h"
+
+static bool hasExtension(const char * name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    return false;
+}
+
+void DisplayReadback::init(GLADloadproc load, int pWidth, int pHeight, size_t pParticleSize)
+{
+    width = pWidth;
+    height = pHeight;
+    particleSize = pParticleSize;
+    // regions and their parts 64-byte aligned for the DMA engines
+    auto align = [](size_t n) { return (n + 63) & ~(size_t)63; };
+    displayBytes = align((size_t)width * height * 4 * sizeof(float));
+    licBytes = align((size_t)width * height);
+    particleBytes = align(particleSize);
+    regionBytes = displayBytes + licBytes + particleBytes;
+
+    PFNGLBUFFERSTORAGEPROC bufferStorage = NULL;
+    if ((GLVersion.major == 4 && GLVersion.minor >= 4) || GLVersion.major > 4 || hasExtension("GL_ARB_buffer_storage"))
+        bufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+
+    if (bufferStorage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        bufferStorage(GL_PIXEL_UNPACK_BUFFER, 3 * regionBytes, NULL, flags);
+        mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, 3 * regionBytes, flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        persistent = mapped != NULL;
+        if (!persistent)
+            glDeleteBuffers(1, &pbo);
+    }
+    if (!persistent) {
+        std::cout << "ARB_buffer_storage not available, uploading from host memory" << std::endl;
+        host.resize(3 * regionBytes);
+    }
+}
+
+void DisplayReadback::upload(int slot, unsigned int displayTex, unsigned int licTex, bool withLic, unsigned int particleVBO)
+{
+    // with the pixel buffer bound, the source pointers are offsets into it
+    const unsigned char * src = persistent ? (const unsigned char *)(uintptr_t)(slot * regionBytes) : base(slot);
+    if (persistent)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+
+    glBindTexture(GL_TEXTURE_2D, displayTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, src);
+    if (withLic) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, licTex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, src + displayBytes);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    if (persistent)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (particleVBO && particleSize > 0) {
+        if (persistent) {
+            glBindBuffer(GL_COPY_READ_BUFFER, pbo);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, particleVBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                slot * regionBytes + displayBytes + licBytes, 0, particleSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        } else {
+            glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, particleSize, particles(slot));
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+}
+
+void DisplayReadback::release()
+{
+    if (persistent) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+        persistent = false;
+    }
+    host.clear();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <glad/glad.h>
+
+// ARB_buffer_storage (GL 4.4) is not part of the GL 3.3 loader
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void * data, GLbitfield flags);
+
+// Host-visible staging of the three display slots for CL devices without GL sharing.
+// The simulation thread reads the display output of a slot into its region with
+// plain CL reads, the GL thread uploads the region after consuming the slot. Regions
+// live in one persistently mapped pixel buffer (ARB_buffer_storage), so uploads are
+// DMA copies and CL writes straight into memory GL reads; without the extension they
+// are ordinary host memory. The triple buffer keeps the read of frame n apart from the
+// upload and drawing of frame n-1.
+class DisplayReadback
+{
+public:
+    bool persistent = false;
+
+    // GL thread: allocate the regions, _load_ resolves GL entry points
+    void init(GLADloadproc load, int pWidth, int pHeight, size_t pParticleSize);
+    // any thread: where the display (RGBA float), LIC (R8) and particles of _slot_ go
+    unsigned char * display(int slot) { return base(slot); }
+    unsigned char * lic(int slot) { return base(slot) + displayBytes; }
+    unsigned char * particles(int slot) { return base(slot) + displayBytes + licBytes; }
+    // GL thread: upload region _slot_ to the textures and the particle vertex buffer (0 for none)
+    void upload(int slot, unsigned int displayTex, unsigned int licTex, bool withLic, unsigned int particleVBO);
+    void release();
+
+private:
+    int width = 0, height = 0;
+    size_t displayBytes = 0, licBytes = 0, particleBytes = 0, regionBytes = 0; // 64-byte aligned
+    size_t particleSize = 0;
+    unsigned int pbo = 0;
+    unsigned char * mapped = NULL;
+    std::vector<unsigned char> host;
+
+    unsigned char * base(int slot) { return (persistent ? mapped : host.data()) + slot * regionBytes; }
+};
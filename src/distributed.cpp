@@ -0,0 +1,122 @@
+#include <algorithm>
+
+#include "distributed.h"
+
+DistributedSimulation::DistributedSimulation(cl::Context & pContext, cl::Program & pProgram, cl::Device & pDevice,
+                                             Transport & pTransport, int pWidth, int pHeight)
+    : width(pWidth), height(pHeight), transport(pTransport)
+{
+    int n = transport.size(), r = transport.rank();
+    originY = (int)((long long)height * r / n);
+    rows = (int)((long long)height * (r + 1) / n) - originY;
+
+    sim = Simulation(pContext, pProgram, width, rows + 2);
+    sim.rangeRowBegin = 1;
+    sim.rangeRowEnd = rows + 1;
+    sim.edgeRow[0] = 1;
+    sim.edgeRow[1] = rows;
+    computeQueue = cl::CommandQueue(pContext, pDevice, CL_QUEUE_PROFILING_ENABLE);
+    copyQueue = cl::CommandQueue(pContext, pDevice);
+    slabVis = cl::Image2D(pContext, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, rows + 2);
+    visRangeBuffer = cl::Buffer(pContext, CL_MEM_READ_WRITE, sizeof(cl_float2));
+
+    size_t rowFloats = 3 * (size_t)width * 4;
+    sendTop.resize(rowFloats);
+    sendBottom.resize(rowFloats);
+    recvTop.resize(rowFloats);
+    recvBottom.resize(rowFloats);
+}
+
+void DistributedSimulation::initCellTypes(cl::Image2D & mask, int maskWidth, int maskHeight, int margin)
+{
+    // the halo rows take the cell types of the neighbouring rows of the lattice
+    sim.initCellTypes(computeQueue, mask, maskWidth, maskHeight, margin, originY - 1, height);
+}
+
+void DistributedSimulation::reset()
+{
+    // halo rows start from the same equilibrium as the rows they mirror
+    sim.reset(computeQueue);
+}
+
+void DistributedSimulation::exchangeHalos(cl::Event & edgesDone)
+{
+    int n = transport.size(), r = transport.rank();
+    int above = (r + n - 1) % n, below = (r + 1) % n;
+    size_t rowFloats = (size_t)width * 4;
+    size_t bytes = maxMessageBytes(width);
+
+    cl::size_t<3> region, edgeRegion;
+    region[0] = width; region[1] = 1; region[2] = 1;
+    edgeRegion[0] = width; edgeRegion[1] = 3; edgeRegion[2] = 1;
+    cl::size_t<3> topEdge, bottomEdge, topHalo, bottomHalo;
+    topEdge[0] = 0; topEdge[1] = 0; topEdge[2] = 0;
+    bottomEdge[0] = 0; bottomEdge[1] = 3; bottomEdge[2] = 0;
+    topHalo[0] = 0; topHalo[1] = 0; topHalo[2] = 0;
+    bottomHalo[0] = 0; bottomHalo[1] = rows + 1; bottomHalo[2] = 0;
+
+    // read the new edge rows while the interior band is still running, from the copy the
+    // edge band left in sim.edgeState: the interior band keeps writing the state images.
+    // The next step rewrites edgeState, so the reads are waited for before returning.
+    std::vector<cl::Event> waitEdges(1, edgesDone);
+    cl::Event evRead;
+    copyQueue.enqueueReadImage(sim.edgeState, CL_FALSE, topEdge, edgeRegion, 0, 0, sendTop.data(), &waitEdges);
+    copyQueue.enqueueReadImage(sim.edgeState, CL_FALSE, bottomEdge, edgeRegion, 0, 0, sendBottom.data(), &waitEdges, &evRead);
+    copyQueue.flush();
+    evRead.wait();
+
+    transport.send(above, TAG_HALO_TOP, sendTop.data(), bytes);
+    transport.send(below, TAG_HALO_BOTTOM, sendBottom.data(), bytes);
+    transport.recv(above, TAG_HALO_BOTTOM, recvTop.data(), bytes);
+    transport.recv(below, TAG_HALO_TOP, recvBottom.data(), bytes);
+
+    // the interior band does not touch the halo rows, the next step is queued behind these
+    for (int j = 0; j < 3; j++) {
+        computeQueue.enqueueWriteImage(sim.state[sim.readIdx][j], CL_FALSE, topHalo, region, 0, 0, &recvTop[j * rowFloats]);
+        computeQueue.enqueueWriteImage(sim.state[sim.readIdx][j], CL_FALSE, bottomHalo, region, 0, 0, &recvBottom[j * rowFloats]);
+    }
+    computeQueue.flush();
+}
+
+void DistributedSimulation::reduceRange()
+{
+    // (min, max) of every rank, combined on the host of every rank
+    float range[2], other[2];
+    computeQueue.enqueueReadBuffer(sim.visRangeDevice(), CL_TRUE, 0, sizeof(range), range);
+    for (int peer = 0; peer < transport.size(); peer++)
+        if (peer != transport.rank())
+            transport.send(peer, TAG_RANGE, range, sizeof(range));
+    for (int peer = 0; peer < transport.size(); peer++) {
+        if (peer == transport.rank())
+            continue;
+        transport.recv(peer, TAG_RANGE, other, sizeof(other));
+        range[0] = std::min(range[0], other[0]);
+        range[1] = std::max(range[1], other[1]);
+    }
+    computeQueue.enqueueWriteBuffer(visRangeBuffer, CL_TRUE, 0, sizeof(range), range);
+}
+
+void DistributedSimulation::step(int steps, cl::Image * vis, int visMode)
+{
+    for (int s = 0; s < steps; s++) {
+        bool fused = vis && s == steps - 1;
+        cl::Event edgesDone;
+        sim.stepEdgesFirst(computeQueue, 2, NULL, edgesDone, fused ? &slabVis : NULL, visMode);
+        exchangeHalos(edgesDone);
+    }
+
+    if (vis && steps > 0) {
+        cl::size_t<3> srcOrigin, dstOrigin, region;
+        srcOrigin[0] = 0; srcOrigin[1] = 1; srcOrigin[2] = 0;
+        dstOrigin[0] = 0; dstOrigin[1] = 0; dstOrigin[2] = 0;
+        region[0] = width; region[1] = rows; region[2] = 1;
+        computeQueue.enqueueCopyImage(slabVis, *vis, srcOrigin, dstOrigin, region);
+        reduceRange();
+    }
+}
+
+void DistributedSimulation::finish()
+{
+    copyQueue.finish();
+    sim.finish(computeQueue);
+}
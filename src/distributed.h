@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "perf_util.h"
+#include "simulation.h"
+#include "transport.h"
+
+// The slab of one process of a distributed run: rows [originY, originY + rows) of the
+// lattice plus a halo row above and below, exchanged with the neighbouring ranks
+// through a Transport after every step (wrapping in y like the single-device lattice).
+// The edge bands of a step are computed first and their rows read back on a second
+// queue, so the host sends and receives them while the interior band is computed.
+class DistributedSimulation
+{
+public:
+    int width = 0, height = 0;          // of the whole lattice
+    int originY = 0, rows = 0;          // lattice rows of this rank
+
+    DistributedSimulation(cl::Context & pContext, cl::Program & pProgram, cl::Device & pDevice,
+                          Transport & pTransport, int pWidth, int pHeight);
+
+    // the largest message sent by a rank, for sizing the transport
+    static size_t maxMessageBytes(int width) { return 3 * (size_t)width * 4 * sizeof(float); }
+
+    void initCellTypes(cl::Image2D & mask, int maskWidth, int maskHeight, int margin);
+    void reset();
+    // advance _steps_ time steps. With _vis_ given (width x rows), the last step writes the
+    // visualization of this rank's rows into it, and visRangeDevice() receives the range of
+    // the whole lattice, so that the images of all ranks share one scale.
+    void step(int steps, cl::Image * vis = NULL, int visMode = VIS_VELOCITY);
+    void finish();
+
+    cl::CommandQueue & queue() { return computeQueue; }
+    cl::Buffer & visRangeDevice() { return visRangeBuffer; }
+    std::vector<KernelStats *> stats() { return sim.stats(); }
+
+private:
+    Transport & transport;
+    Simulation sim;                     // rows + 2 high, the halo rows are 0 and rows + 1
+    cl::CommandQueue computeQueue, copyQueue;
+    cl::Image2D slabVis;
+    cl::Buffer visRangeBuffer;
+    std::vector<float> sendTop, sendBottom, recvTop, recvBottom;   // one row of each state image
+
+    void exchangeHalos(cl::Event & edgesDone);
+    void reduceRange();
+};
@@ -0,0 +1,78 @@
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "ensemble.h"
+#include "mask.h"
+
+bool loadEnsemble(const std::string & path, std::vector<EnsembleMember> & members)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Unable to read ensemble " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int lineNo = 1; std::getline(file, line); lineNo++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        EnsembleMember member;
+        if (!(fields >> member.tau)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+        } else if (fields >> member.ux >> member.uy) {
+            fields >> member.maskPath;
+            if (member.tau > 0.5f) {
+                members.push_back(member);
+                continue;
+            }
+        }
+        std::cout << path << ":" << lineNo << ": expected tau (> 0.5) ux uy [mask]" << std::endl;
+        return false;
+    }
+    if (members.empty()) {
+        std::cout << "No members in ensemble " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool initEnsemble(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram, Simulation & sim,
+                  const std::vector<EnsembleMember> & members, const std::string & defaultMask,
+                  int memberHeight, int margin)
+{
+    struct LoadedMask {
+        cl::Image2D image;
+        int width, height;
+        bool loaded = false;
+    };
+    std::map<std::string, LoadedMask> masks;
+
+    std::vector<cl_float4> params(members.size());
+    for (size_t m = 0; m < members.size(); m++) {
+        const EnsembleMember & member = members[m];
+        params[m].s[0] = member.tau;
+        params[m].s[1] = member.rho;
+        params[m].s[2] = member.ux;
+        params[m].s[3] = member.uy;
+
+        // members sharing a mask load it once
+        std::string maskPath = member.maskPath.empty() ? defaultMask : member.maskPath;
+        LoadedMask & mask = masks[maskPath];
+        if (!mask.loaded) {
+            if (!loadLatticeMask(pContext, pQueue, pProgram, maskPath.c_str(), sim.width, memberHeight, mask.image,
+                                 mask.width, mask.height))
+                return false;
+            mask.loaded = true;
+        }
+        sim.resampleCellTypes(pQueue, mask.image, mask.width, mask.height, margin, 0, memberHeight,
+                              (int)m * memberHeight, memberHeight);
+    }
+    sim.summarizeCellTypes(pQueue);
+
+    cl::Buffer paramBuffer(pContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, params.size() * sizeof(cl_float4), params.data());
+    sim.setMembers(paramBuffer, memberHeight);
+    return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "simulation.h"
+
+// One member of an ensemble of independent lattices of the same size
+struct EnsembleMember {
+    float tau = 0.58f;
+    float rho = 1.0f;
+    float ux = 0.3f, uy = 0.06f;
+    std::string maskPath;               // empty: the mask of the run
+};
+
+// Read members from a text file, one per line: tau ux uy [mask], '#' starts a comment.
+// Returns false (after printing the line) on malformed lines or an empty file.
+bool loadEnsemble(const std::string & path, std::vector<EnsembleMember> & members);
+
+// Set up _sim_, a lattice of width x (members.size() * memberHeight) cells, as the members
+// stacked bottom-up: each member's mask is resampled into its rows and its parameters
+// go to a constant buffer, so that a single lbm launch advances all of them. Masks may be
+// geometry files, _defaultMask_ is only read if a member names none. Returns false if a
+// mask cannot be read.
+bool initEnsemble(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram, Simulation & sim,
+                  const std::vector<EnsembleMember> & members, const std::string & defaultMask,
+                  int memberHeight, int margin);
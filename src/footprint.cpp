@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "footprint.h"
+#include "offscreen.h"
+#include "out_of_core.h"
+#include "simulation.h"
+
+#define DEVICE_MEMORY_SHARE 0.9     // of the global memory, the rest is left to the driver
+#define DISPLAY_SLOTS 3             // display images in flight in the interactive view
+
+#define MB(bytes) ((bytes) / (1024 * 1024))
+
+// a Simulation of _rows_ rows: state double buffer, cell types, occupancy and tile summaries
+static size_t latticeBytes(const RunShape & shape, int rows)
+{
+    size_t cells = (size_t)shape.width * rows;
+    size_t tiles = (size_t)NUM_BLOCKS(shape.width, THREAD_PER_BLOCK_DIM) * NUM_BLOCKS(rows, THREAD_PER_BLOCK_DIM);
+    return 2 * cells * shape.channelsPerCell * shape.bytesPerChannel + cells +
+           (size_t)NUM_BLOCKS(shape.width, 32) * rows * sizeof(cl_uint) + tiles * (1 + sizeof(cl_float2));
+}
+
+Footprint computeFootprint(const RunShape & shape)
+{
+    Footprint f;
+    size_t texel = 4 * shape.bytesPerChannel;
+    size_t latticeCells = (size_t)shape.width * shape.height;
+    int imageRows = shape.height;
+
+    f.deviceBytes = (size_t)shape.maskWidth * shape.maskHeight;
+    f.hostBytes = (size_t)shape.maskWidth * shape.maskHeight;
+    if (shape.outOfCore) {
+        // slots of a chunk and its halo on the device, the lattice twice on the host
+        int chunks = NUM_BLOCKS(shape.height, shape.chunkRows);
+        int sliceRows = std::min(shape.chunkRows, shape.height) + 2 * shape.blockSteps;
+        size_t sliceCells = (size_t)shape.width * sliceRows;
+        f.deviceBytes += std::min(OUT_OF_CORE_SLOTS, chunks) * (latticeBytes(shape, sliceRows) + sliceCells * texel);
+        f.hostBytes += 2 * latticeCells * shape.channelsPerCell * shape.bytesPerChannel +
+                       (size_t)chunks * (latticeBytes(shape, sliceRows) - 2 * sliceCells * shape.channelsPerCell * shape.bytesPerChannel);
+        if (shape.images)
+            f.hostBytes += latticeCells * (texel + 4);
+        f.largestImageHeight = sliceRows;
+        f.largestAllocation = sliceCells * texel;
+    } else {
+        // the busiest device holds one slab, with a halo row on either side if there are more
+        int rows = NUM_BLOCKS(shape.height, shape.slabs) + (shape.slabs > 1 ? 2 : 0);
+        size_t slabCells = (size_t)shape.width * rows;
+        f.deviceBytes += latticeBytes(shape, rows);
+        if (shape.slabs > 1)
+            f.deviceBytes += slabCells * texel + 3 * (size_t)shape.width * 2 * texel;
+        if (shape.slabs > 1 && shape.imagesPerSlab)
+            imageRows = rows - 2;
+        f.largestImageHeight = rows;
+        f.largestAllocation = slabCells * texel;
+    }
+
+    // the images are gathered on the first device, or written by each rank of its rows
+    size_t imageCells = (size_t)shape.width * imageRows;
+    if (shape.images && !shape.outOfCore) {
+        f.deviceBytes += imageCells * (texel + 4);
+        f.hostBytes += OFFSCREEN_STAGING_COUNT * imageCells * 4;
+        f.largestImageHeight = std::max(f.largestImageHeight, imageRows);
+        f.largestAllocation = std::max(f.largestAllocation, imageCells * texel);
+    }
+    if (shape.display) {
+        // RGBA float quantity and 8-bit LIC per slot with their mip chains, a third more
+        f.deviceBytes += DISPLAY_SLOTS * latticeCells * (texel + 1) * 4 / 3;
+        if (shape.displayReadback) {
+            f.deviceBytes += DISPLAY_SLOTS * latticeCells * (texel + 1);
+            f.hostBytes += DISPLAY_SLOTS * (latticeCells * (texel + 1) + (size_t)shape.particles * sizeof(cl_float4));
+        }
+        f.deviceBytes += DISPLAY_SLOTS * (size_t)shape.particles * sizeof(cl_float4);
+    }
+    f.deviceBytes += 2 * (size_t)shape.particles * sizeof(cl_float4);
+    if (shape.wallDistance)
+        f.deviceBytes += latticeCells * sizeof(cl_float);
+    f.largestImageWidth = shape.width;
+    return f;
+}
+
+MemoryLimits memoryLimits(const std::vector<cl::Device> & devices)
+{
+    MemoryLimits limits;
+    for (size_t i = 0; i < devices.size(); i++) {
+        cl_ulong global = devices[i].getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+        cl_ulong maxAlloc = devices[i].getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+        size_t maxWidth = devices[i].getInfo<CL_DEVICE_IMAGE2D_MAX_WIDTH>();
+        size_t maxHeight = devices[i].getInfo<CL_DEVICE_IMAGE2D_MAX_HEIGHT>();
+        size_t usable = (size_t)(global * DEVICE_MEMORY_SHARE);
+        limits.deviceBytes = i == 0 ? usable : std::min(limits.deviceBytes, usable);
+        limits.maxAllocation = i == 0 ? (size_t)maxAlloc : std::min(limits.maxAllocation, (size_t)maxAlloc);
+        limits.maxImageWidth = i == 0 ? maxWidth : std::min(limits.maxImageWidth, maxWidth);
+        limits.maxImageHeight = i == 0 ? maxHeight : std::min(limits.maxImageHeight, maxHeight);
+    }
+
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        limits.hostBytes = (size_t)status.ullTotalPhys;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES), pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0)
+        limits.hostBytes = (size_t)pages * pageSize;
+#endif
+    return limits;
+}
+
+static bool fits(const Footprint & f, const MemoryLimits & limits)
+{
+    return f.deviceBytes <= limits.deviceBytes && f.largestAllocation <= limits.maxAllocation &&
+           (size_t)f.largestImageWidth <= limits.maxImageWidth && (size_t)f.largestImageHeight <= limits.maxImageHeight &&
+           (limits.hostBytes == 0 || f.hostBytes <= limits.hostBytes);
+}
+
+bool checkFootprint(const Footprint & f, const MemoryLimits & limits)
+{
+    std::cout << "memory: " << MB(f.deviceBytes) << " of " << MB(limits.deviceBytes) << " MB per device, largest allocation "
+              << MB(f.largestAllocation) << " of " << MB(limits.maxAllocation) << " MB, images up to "
+              << f.largestImageWidth << "x" << f.largestImageHeight << " of " << limits.maxImageWidth << "x"
+              << limits.maxImageHeight << ", " << MB(f.hostBytes) << " of " << MB(limits.hostBytes) << " MB on the host"
+              << std::endl;
+    if (f.deviceBytes > limits.deviceBytes)
+        std::cout << "  the device memory is too small" << std::endl;
+    if (f.largestAllocation > limits.maxAllocation)
+        std::cout << "  an allocation exceeds CL_DEVICE_MAX_MEM_ALLOC_SIZE" << std::endl;
+    if ((size_t)f.largestImageWidth > limits.maxImageWidth || (size_t)f.largestImageHeight > limits.maxImageHeight)
+        std::cout << "  an image exceeds the image size limit" << std::endl;
+    if (limits.hostBytes != 0 && f.hostBytes > limits.hostBytes)
+        std::cout << "  the host memory is too small" << std::endl;
+    return fits(f, limits);
+}
+
+bool fitFootprint(RunShape & shape, const MemoryLimits & limits)
+{
+    // the footprint grows with the chunk rows and the lattice scale, bisect either
+    RunShape trial = shape;
+    if (shape.outOfCore) {
+        int lo = 0, hi = std::min(shape.chunkRows, shape.height);
+        while (lo < hi) {
+            trial.chunkRows = (lo + hi + 1) / 2;
+            if (fits(computeFootprint(trial), limits))
+                lo = trial.chunkRows;
+            else
+                hi = trial.chunkRows - 1;
+        }
+        if (lo == 0)
+            return false;
+        shape.chunkRows = lo;
+        return true;
+    }
+
+    double lo = 0.0, hi = 1.0;
+    for (int i = 0; i < 30; i++) {
+        double scale = 0.5 * (lo + hi);
+        trial.width = std::max(1, (int)(shape.width * scale));
+        trial.height = std::max(1, (int)(shape.height * scale));
+        (fits(computeFootprint(trial), limits) ? lo : hi) = scale;
+    }
+    trial.width = (int)(shape.width * lo);
+    trial.height = (int)(shape.height * lo);
+    if (trial.width < THREAD_PER_BLOCK_DIM || trial.height < THREAD_PER_BLOCK_DIM)
+        return false;
+    shape = trial;
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+// What a run allocates, for planning its memory before anything is allocated
+struct RunShape {
+    int width = 0, height = 0;          // lattice, all ensemble members together
+    int maskWidth = 0, maskHeight = 0;
+    int slabs = 1;                      // devices or ranks the rows are split over
+    bool imagesPerSlab = false;         // ranks write images of their rows, else they are gathered
+    bool outOfCore = false;
+    int chunkRows = 0, blockSteps = 0;  // of an out-of-core run
+    bool images = true;                 // headless images: visualization, RGBA8 and staging
+    bool display = false;               // interactive: display and LIC textures, 3 slots with mipmaps
+    bool displayReadback = false;       // ... and CL images of them read back through the host
+    int particles = 0;
+    bool wallDistance = false;          // float distance to the walls of a procedural geometry
+    // state storage: 9 distributions padded to 3 RGBA texels of 4-byte floats, double buffered
+    int channelsPerCell = 12;
+    int bytesPerChannel = 4;
+};
+
+// Memory of the busiest device and of the host, in bytes
+struct Footprint {
+    size_t deviceBytes = 0;
+    size_t largestAllocation = 0;       // a single image or buffer
+    int largestImageWidth = 0, largestImageHeight = 0;
+    size_t hostBytes = 0;
+};
+
+// Capacity of the smallest of _devices_ and of the host. Only a share of the device
+// memory is counted usable, the driver and the display need the rest.
+struct MemoryLimits {
+    size_t deviceBytes = 0;
+    size_t maxAllocation = 0;
+    size_t maxImageWidth = 0, maxImageHeight = 0;
+    size_t hostBytes = 0;               // physical memory, 0 if unknown
+};
+
+Footprint computeFootprint(const RunShape & shape);
+MemoryLimits memoryLimits(const std::vector<cl::Device> & devices);
+
+// print the footprint against the limits, returns whether it fits
+bool checkFootprint(const Footprint & footprint, const MemoryLimits & limits);
+
+// shrink _shape_ to the largest configuration that fits: fewer rows per chunk for an
+// out-of-core run, else a smaller lattice of the same aspect ratio. Returns false if
+// nothing fits, leaving _shape_ unchanged.
+bool fitFootprint(RunShape & shape, const MemoryLimits & limits);
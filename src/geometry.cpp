@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "geometry.h"
+#include "simulation.h"
+
+#define NACA_POINTS 64                  // per side of an airfoil, cosine spaced along the chord
+
+static const char * kindNames[] = { "solid", "fluid", "inlet", "outlet" };
+
+static cl_float8 makeShape(ShapeType type, int kind, float p0 = 0.0f, float p1 = 0.0f, float p2 = 0.0f, float p3 = 0.0f)
+{
+    cl_float8 s = {};
+    s.s[0] = (float)type;
+    s.s[1] = (float)kind;
+    s.s[2] = p0;
+    s.s[3] = p1;
+    s.s[4] = p2;
+    s.s[5] = p3;
+    return s;
+}
+
+static void addVertex(Geometry & geometry, float x, float y)
+{
+    cl_float2 v;
+    v.s[0] = x;
+    v.s[1] = y;
+    geometry.vertices.push_back(v);
+}
+
+// NACA 4-digit section of unit chord, upper side from the trailing to the leading edge,
+// then the lower side back, scaled, pitched and moved to _x_, _y_
+static bool addNaca(Geometry & geometry, const std::string & digits, float x, float y, float chord, float angle)
+{
+    if (digits.size() != 4 || digits.find_first_not_of("0123456789") != std::string::npos || chord <= 0.0f)
+        return false;
+    double m = (digits[0] - '0') / 100.0;
+    double p = (digits[1] - '0') / 10.0;
+    double t = std::stoi(digits.substr(2)) / 100.0;
+    if (t <= 0.0)
+        return false;
+
+    const double pi = 3.14159265358979323846;
+    double c = cos(-angle * pi / 180.0), s = sin(-angle * pi / 180.0);
+    for (int side = 0; side < 2; side++) {
+        for (int i = 0; i <= NACA_POINTS; i++) {
+            // the leading edge once, as the last upper point
+            if (side == 1 && i == 0)
+                continue;
+            int k = side == 0 ? NACA_POINTS - i : i;
+            double xc = 0.5 * (1.0 - cos(pi * k / NACA_POINTS));
+            // closed trailing edge coefficients
+            double yt = 5.0 * t * (0.2969 * sqrt(xc) - 0.1260 * xc - 0.3516 * xc * xc + 0.2843 * xc * xc * xc -
+                                   0.1036 * xc * xc * xc * xc);
+            double yc = 0.0, slope = 0.0;
+            if (m > 0.0 && p > 0.0) {
+                double q = xc < p ? p : 1.0 - p;
+                yc = m / (q * q) * (xc < p ? 2.0 * p * xc - xc * xc : 1.0 - 2.0 * p + 2.0 * p * xc - xc * xc);
+                slope = 2.0 * m / (q * q) * (p - xc);
+            }
+            double theta = atan(slope);
+            double sign = side == 0 ? 1.0 : -1.0;
+            double px = (xc - sign * yt * sin(theta)) * chord;
+            double py = (yc + sign * yt * cos(theta)) * chord;
+            addVertex(geometry, (float)(x + c * px - s * py), (float)(y + s * px + c * py));
+        }
+    }
+    return true;
+}
+
+bool isGeometryPath(const std::string & path)
+{
+    return path.size() > 4 && path.compare(path.size() - 4, 4, ".geo") == 0;
+}
+
+bool loadGeometry(const char * path, Geometry & geometry, bool report)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Unable to read geometry " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int lineNo = 1; std::getline(file, line); lineNo++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string word, shape;
+        if (!(fields >> word))
+            continue;
+
+        bool ok = false;
+        int kind = -1;
+        for (int k = 0; k < 4; k++)
+            if (word == kindNames[k])
+                kind = k;
+        std::string rest;
+        if (word == "size") {
+            ok = fields >> geometry.width >> geometry.height && geometry.width > 0 && geometry.height > 0;
+        } else if (kind >= 0 && fields >> shape) {
+            float v[4];
+            if (shape == "circle") {
+                ok = fields >> v[0] >> v[1] >> v[2] && v[2] > 0.0f;
+                if (ok)
+                    geometry.shapes.push_back(makeShape(SHAPE_CIRCLE, kind, v[0], v[1], v[2]));
+            } else if (shape == "rect") {
+                ok = (bool)(fields >> v[0] >> v[1] >> v[2] >> v[3]);
+                if (ok)
+                    geometry.shapes.push_back(makeShape(SHAPE_RECT, kind, std::fmin(v[0], v[2]), std::fmin(v[1], v[3]),
+                                                        std::fmax(v[0], v[2]), std::fmax(v[1], v[3])));
+            } else if (shape == "polygon" || shape == "naca") {
+                size_t first = geometry.vertices.size();
+                if (shape == "polygon") {
+                    std::vector<float> xy;
+                    while (fields >> v[0])
+                        xy.push_back(v[0]);
+                    ok = fields.eof() && xy.size() >= 6 && xy.size() % 2 == 0;
+                    for (size_t i = 0; ok && i < xy.size(); i += 2)
+                        addVertex(geometry, xy[i], xy[i + 1]);
+                } else {
+                    std::string digits;
+                    ok = fields >> digits >> v[0] >> v[1] >> v[2] >> v[3] && addNaca(geometry, digits, v[0], v[1], v[2], v[3]);
+                }
+                if (ok)
+                    geometry.shapes.push_back(makeShape(SHAPE_POLYGON, kind, (float)first,
+                                                        (float)(geometry.vertices.size() - first)));
+                else
+                    geometry.vertices.resize(first);
+            }
+        }
+        if (ok && !(fields >> rest))
+            continue;
+
+        std::cout << path << ":" << lineNo << ": expected size W H, or solid, fluid, inlet or outlet and"
+                  << " circle cx cy r, rect x0 y0 x1 y1, polygon x y x y x y ... or naca dddd x y chord angle" << std::endl;
+        return false;
+    }
+    if (geometry.width == 0) {
+        std::cout << "No size line in geometry " << path << std::endl;
+        return false;
+    }
+    if (report)
+        std::cout << "geometry (HxW):" << geometry.height << " x " << geometry.width << ", " << geometry.shapes.size()
+                  << " shapes" << std::endl;
+    return true;
+}
+
+void rasterizeGeometry(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram,
+                       const Geometry & geometry, int width, int height, cl::Image2D & cellTypes,
+                       cl::Image2D * distance)
+{
+    cellTypes = cl::Image2D(pContext, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), width, height);
+    cl::Image2D distanceImage = distance ? cl::Image2D(pContext, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, height)
+                                         : cl::Image2D(pContext, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), 1, 1);
+
+    // buffers may not be empty, a geometry without shapes or polygons passes a dummy
+    std::vector<cl_float8> shapes = geometry.shapes;
+    std::vector<cl_float2> vertices = geometry.vertices;
+    shapes.resize(std::max<size_t>(shapes.size(), 1));
+    vertices.resize(std::max<size_t>(vertices.size(), 1));
+    cl::Buffer shapeBuffer(pContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, shapes.size() * sizeof(cl_float8), shapes.data());
+    cl::Buffer vertexBuffer(pContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, vertices.size() * sizeof(cl_float2), vertices.data());
+
+    cl_float2 scale;
+    scale.s[0] = (float)geometry.width / width;
+    scale.s[1] = (float)geometry.height / height;
+    cl::Kernel kernel(pProgram, "rasterizeGeometry");
+    kernel.setArg(0, cellTypes);                            // cell_type_tex
+    kernel.setArg(1, distanceImage);                        // distance_tex
+    kernel.setArg(2, distance ? 1 : 0);                     // write_distance
+    kernel.setArg(3, shapeBuffer);                          // shapes
+    kernel.setArg(4, (int)geometry.shapes.size());          // shape_count
+    kernel.setArg(5, vertexBuffer);                         // vertices
+    kernel.setArg(6, scale);                                // scale
+    kernel.setArg(7, width);                                // image_size_x
+    kernel.setArg(8, height);                               // image_size_y
+
+    cl::NDRange blockCfg(THREAD_PER_BLOCK_DIM, THREAD_PER_BLOCK_DIM);
+    cl::NDRange gridCfg(THREAD_PER_BLOCK_DIM * NUM_BLOCKS(width, THREAD_PER_BLOCK_DIM),
+                        THREAD_PER_BLOCK_DIM * NUM_BLOCKS(height, THREAD_PER_BLOCK_DIM));
+    pQueue.enqueueNDRangeKernel(kernel, cl::NullRange, gridCfg, blockCfg);
+    pQueue.finish();
+    if (distance)
+        *distance = distanceImage;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+// Procedural geometry: signed-distance primitives in the cells of a reference lattice,
+// y counted bottom-up as the lattice. lbm.cl receives the shape and kind values as
+// preprocessor definitions, see geometryDefines().
+enum ShapeType { SHAPE_CIRCLE = 0, SHAPE_RECT, SHAPE_POLYGON };
+
+// How a shape combines with the ones before it: solid shapes are added to the walls
+// (union), fluid ones are cut out of them (difference) and reset the open cells they
+// cover to fluid, inlets and outlets mark the open cells they cover
+enum ShapeKind { SHAPE_SOLID = 0, SHAPE_FLUID, SHAPE_INLET, SHAPE_OUTLET };
+
+inline std::string geometryDefines()
+{
+    return " -DSHAPE_CIRCLE=" + std::to_string(SHAPE_CIRCLE) +
+           " -DSHAPE_RECT=" + std::to_string(SHAPE_RECT) +
+           " -DSHAPE_POLYGON=" + std::to_string(SHAPE_POLYGON) +
+           " -DSHAPE_SOLID=" + std::to_string(SHAPE_SOLID) +
+           " -DSHAPE_FLUID=" + std::to_string(SHAPE_FLUID) +
+           " -DSHAPE_INLET=" + std::to_string(SHAPE_INLET) +
+           " -DSHAPE_OUTLET=" + std::to_string(SHAPE_OUTLET);
+}
+
+// Shapes in the order they are applied, one float8 each: (type, kind, parameters...),
+// circle (cx, cy, r), rect (x0, y0, x1, y1), polygon (first vertex, vertex count)
+struct Geometry {
+    int width = 0, height = 0;          // reference lattice, the size line of the file
+    std::vector<cl_float8> shapes;
+    std::vector<cl_float2> vertices;    // of all polygons
+};
+
+// Geometry files are told from mask images by their .geo extension
+bool isGeometryPath(const std::string & path);
+
+// Read a geometry file, one line each: "size W H" once, then shapes
+//   solid|fluid|inlet|outlet circle cx cy r
+//   solid|fluid|inlet|outlet rect x0 y0 x1 y1
+//   solid|fluid|inlet|outlet polygon x y x y x y ...
+//   solid|fluid|inlet|outlet naca dddd x y chord angle
+// the last a NACA 4-digit airfoil with its leading edge at (x, y), pitched nose-up by
+// _angle_ degrees, turned into a polygon. '#' starts a comment. Returns false (after
+// printing the line) on malformed lines or a missing size. _report_ prints the size and
+// shape count.
+bool loadGeometry(const char * path, Geometry & geometry, bool report = true);
+
+// Evaluate the shapes at the cell centres of a width x height lattice spanning the
+// reference lattice, into new images: the cell types (CL_R, CL_UNSIGNED_INT8) and, if
+// _distance_ is given, the signed distance to the walls in cells (CL_R, CL_FLOAT),
+// negative inside them, for boundaries placed between the cells
+void rasterizeGeometry(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram,
+                       const Geometry & geometry, int width, int height, cl::Image2D & cellTypes,
+                       cl::Image2D * distance = NULL);
@@ -0,0 +1,9 @@
+#version 330 core
+in float fade;
+out vec4 FragColor;
+
+void main()
+{
+    // particles fade out towards the end of their lifetime
+    FragColor = vec4(1.0, 1.0, 1.0, 0.6 * fade);
+}
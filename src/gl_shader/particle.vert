@@ -0,0 +1,15 @@
+#version 330 core
+layout (location = 0) in vec4 aParticle;	// lattice position in xy, age in z
+
+uniform vec2 lattice_size;
+uniform float lifetime;
+uniform vec4 view_rect;		// visible part of the lattice: origin and size in texture coordinates
+
+out float fade;
+
+void main()
+{
+    vec2 pos = (aParticle.xy / lattice_size - view_rect.xy) / view_rect.zw;
+    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+    fade = 1.0 - aParticle.z / lifetime;
+}
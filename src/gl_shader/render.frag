@@ -1,20 +1,30 @@
 #version 330 core
 in vec2 texCoord;
 out vec4 FragColor;
-uniform sampler2D boundary_texture;	//boundary texture map specifying boundaries
-uniform sampler2D state_texture3;	    //input texture containing f0, rho, ux and uy
+uniform sampler2D display_texture;	//displayed quantity in x, 1 for fluid and 0 for solid in y
+uniform sampler1D colormap;			//lookup table of the color scale
+uniform sampler2D lic_texture;		//line integral convolution of the velocity
+uniform int lic_enabled;
+uniform float value_min;			//range of the displayed quantity
+uniform float value_max;
 
 void main()
 {
 
     vec2 pos = texCoord.xy;		//	Position of each lattice node	
+    vec4 display = texture( display_texture, pos );
 
-    if ( texture2D( boundary_texture,pos ).x > 0.5 ) {
-        float color = texture2D( state_texture3, pos ).y;
-        FragColor = vec4( color * 0.4, color * 0.6, color, 0.0 );
+    if ( display.y > 0.5 ) {
+        float t = clamp( (display.x - value_min) / (value_max - value_min), 0.0, 1.0 );
+        vec3 rgb = texture( colormap, t ).rgb;
+        if ( lic_enabled != 0 ) {
+            // streamline texture modulates the color of the quantity
+            rgb *= 0.2 + 1.2 * texture( lic_texture, pos ).r;
+        }
+        FragColor = vec4( clamp( rgb, 0.0, 1.0 ), 0.0 );
     } else {
         // boundary, draw black
         FragColor = vec4(0.0, 0.0, 0.0, 0.0);
     }
     
-}
\ No newline at end of file
+}
@@ -4,8 +4,10 @@ layout (location = 1) in vec2 aTexCoord;
 
 out vec2 texCoord;
 
+uniform vec4 view_rect;		// visible part of the lattice: origin and size in texture coordinates
+
 void main()
 {
     gl_Position = vec4(aPos, 1.0);
-    texCoord = aTexCoord;
+    texCoord = view_rect.xy + aTexCoord * view_rect.zw;
 }
\ No newline at end of file
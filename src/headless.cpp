@@ -0,0 +1,280 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "cl_util.h"
+#include "colormap.h"
+#include "distributed.h"
+#include "ensemble.h"
+#include "footprint.h"
+#include "geometry.h"
+#include "headless.h"
+#include "mask.h"
+#include "multi_device.h"
+#include "offscreen.h"
+#include "out_of_core.h"
+#include "perf_util.h"
+#include "simulation.h"
+#include "transport.h"
+
+int findName(const std::string & name, int count, const char * (*nameOf)(int))
+{
+    for (int i = 0; i < count; i++)
+        if (name == nameOf(i))
+            return i;
+    return -1;
+}
+
+// the GPUs of the platform (any device if there is none), or equal sub-devices of the CPU.
+// Distributed runs get every GPU and pick one by rank.
+static std::vector<cl::Device> selectDevices(cl::Platform & plat, const Options & opts)
+{
+    std::vector<cl::Device> vDevices;
+    if (opts.cpuSubdevices > 0) {
+        std::vector<cl::Device> cpus;
+        plat.getDevices(CL_DEVICE_TYPE_CPU, &cpus);
+        if (cpus.empty())
+            return vDevices;
+        cl_uint units = cpus[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        cl_device_partition_property props[3] = {
+            CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)std::max(1u, units / opts.cpuSubdevices), 0 };
+        cpus[0].createSubDevices(props, &vDevices);
+        if ((int)vDevices.size() > opts.cpuSubdevices)
+            vDevices.resize(opts.cpuSubdevices);
+        return vDevices;
+    }
+
+    plat.getDevices(CL_DEVICE_TYPE_GPU, &vDevices);
+    if (vDevices.empty())
+        plat.getDevices(CL_DEVICE_TYPE_ALL, &vDevices);
+    if (opts.transport.empty() && (int)vDevices.size() > opts.devices)
+        vDevices.resize(opts.devices);
+    return vDevices;
+}
+
+int runHeadless(const Options & opts)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    int visMode = findName(opts.visName, VIS_MODE_COUNT, visModeName);
+    if (visMode < 0) {
+        std::cout << "Unknown quantity " << opts.visName << std::endl;
+        return 1;
+    }
+    int colormap = visModeSigned(visMode) ? COLORMAP_COOLWARM : COLORMAP_VIRIDIS;
+    if (!opts.colormapName.empty()) {
+        colormap = findName(opts.colormapName, COLORMAP_COUNT, colormapName);
+        if (colormap < 0) {
+            std::cout << "Unknown colormap " << opts.colormapName << std::endl;
+            return 1;
+        }
+    }
+
+    // an ensemble stacks its members in one lattice on one device
+    if (!opts.ensemblePath.empty() && (opts.outOfCore || !opts.transport.empty() || opts.devices > 1 || opts.cpuSubdevices > 1)) {
+        std::cout << "--ensemble runs on a single device, not with --devices, --cpu-subdevices, --transport or --out-of-core"
+                  << std::endl;
+        return 1;
+    }
+
+    std::vector<EnsembleMember> members;
+    bool ensemble = !opts.ensemblePath.empty();
+    if (ensemble && !loadEnsemble(opts.ensemblePath, members))
+        return 1;
+    int memberCount = ensemble ? (int)members.size() : 1;
+
+    // only the size for now, the mask goes to the device in strips once there is one. An
+    // ensemble takes the size of its first member's mask.
+    std::string sizeMaskPath = ensemble && !members[0].maskPath.empty() ? members[0].maskPath : opts.maskPath;
+    int maskWidth, maskHeight, width, height;
+    if (!maskSize(sizeMaskPath.c_str(), maskWidth, maskHeight))
+        return 1;
+    latticeSize(opts, maskWidth, maskHeight, width, height);
+
+    // distributed runs hold one slab per process
+    std::unique_ptr<Transport> transport;
+    if (opts.transport == "shm") {
+        transport = createSharedMemoryTransport(opts.shmName, opts.rank, opts.ranks, DistributedSimulation::maxMessageBytes(width));
+        if (!transport)
+            return 1;
+    } else if (opts.transport == "mpi") {
+#ifdef LBMCL_WITH_MPI
+        transport = createMpiTransport();
+#else
+        std::cout << "Built without MPI, configure with -DLBMCL_WITH_MPI=ON" << std::endl;
+        return 1;
+#endif
+    }
+
+    try {
+        // plain CL context, no GL sharing needed
+        cl::Platform plat = getPlatform();
+        std::vector<cl::Device> vDevices = selectDevices(plat, opts);
+        if (vDevices.empty()) {
+            std::cout << "No OpenCL device found" << std::endl;
+            return 1;
+        }
+        int requested = opts.cpuSubdevices > 0 ? opts.cpuSubdevices : opts.devices;
+        if (transport) {
+            cl::Device rankDevice = vDevices[transport->rank() % vDevices.size()];
+            vDevices.assign(1, rankDevice);
+        } else if ((int)vDevices.size() < requested) {
+            std::cout << "Only " << vDevices.size() << " of " << requested << " devices available" << std::endl;
+        }
+
+        // plan the memory of the run before allocating any of it. Distributed runs are not
+        // shrunk, the lattice has to be the same on all ranks.
+        RunShape shape;
+        shape.width = width;
+        shape.height = memberCount * height;
+        shape.maskWidth = maskWidth;
+        shape.maskHeight = maskHeight;
+        // a single lattice keeps the wall distance of a geometry
+        bool single = !opts.outOfCore && !transport && vDevices.size() == 1 && !ensemble;
+        shape.wallDistance = single && isGeometryPath(opts.maskPath);
+        shape.slabs = transport ? transport->size() : (int)vDevices.size();
+        shape.imagesPerSlab = (bool)transport;
+        shape.outOfCore = opts.outOfCore;
+        shape.chunkRows = opts.chunkRows;
+        shape.blockSteps = opts.blockSteps;
+        MemoryLimits limits = memoryLimits(vDevices);
+        bool fits = checkFootprint(computeFootprint(shape), limits);
+        if (!fits && opts.autoFit && (opts.outOfCore || !transport) && fitFootprint(shape, limits)) {
+            width = shape.width;
+            height = shape.height / memberCount;
+            std::cout << "fitted to lattice (HxW): " << height << " x " << width;
+            if (opts.outOfCore)
+                std::cout << ", " << shape.chunkRows << " rows per chunk";
+            std::cout << std::endl;
+            fits = checkFootprint(computeFootprint(shape), limits);
+        }
+        if (!fits)
+            std::cout << "The run does not fit" << (opts.autoFit ? "" : ", --auto-fit shrinks it") << std::endl;
+        if (opts.plan || !fits)
+            return fits ? 0 : 1;
+
+        cl::Device device = vDevices[0];
+        cl::Context context(vDevices);
+        cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+        cl::Program program = buildProgram(context, vDevices);
+        double copyBandwidth = measureCopyBandwidth(context, queue, program, device);
+
+        // ensemble members load their own masks
+        cl::Image2D mask, wallDistance;
+        if (!ensemble && !loadLatticeMask(context, queue, program, opts.maskPath.c_str(), width, height, mask, maskWidth,
+                                          maskHeight, single ? &wallDistance : NULL))
+            return 1;
+
+        // one device runs the lattice as a whole, more split it into slabs with halo exchange;
+        // out-of-core runs and distributed ranks use one device
+        std::unique_ptr<Simulation> sim;
+        std::unique_ptr<MultiDeviceSimulation> slabs;
+        std::unique_ptr<DistributedSimulation> rankSlab;
+        std::unique_ptr<OutOfCoreSimulation> streamed;
+        int imageHeight = height;
+        std::string imageSuffix;
+        if (opts.outOfCore) {
+            streamed.reset(new OutOfCoreSimulation(context, program, device, width, height, shape.chunkRows, opts.blockSteps));
+            streamed->initCellTypes(mask, maskWidth, maskHeight, 2);
+            streamed->reset();
+        } else if (transport) {
+            rankSlab.reset(new DistributedSimulation(context, program, device, *transport, width, height));
+            rankSlab->initCellTypes(mask, maskWidth, maskHeight, 2);
+            rankSlab->reset();
+            rankSlab->finish();
+            imageHeight = rankSlab->rows;
+            if (transport->size() > 1)
+                imageSuffix = "_r" + std::to_string(transport->rank());
+            std::cout << "rank " << transport->rank() << " of " << transport->size() << ": rows "
+                      << rankSlab->originY << " - " << rankSlab->originY + rankSlab->rows - 1 << std::endl;
+        } else if (vDevices.size() > 1) {
+            slabs.reset(new MultiDeviceSimulation(context, program, vDevices, width, height));
+            slabs->initCellTypes(mask, maskWidth, maskHeight, 2);
+            slabs->reset();
+            slabs->finish();
+        } else if (ensemble) {
+            // members stacked in one lattice, the images show all of them
+            imageHeight = memberCount * height;
+            sim.reset(new Simulation(context, program, width, imageHeight));
+            if (!initEnsemble(context, queue, program, *sim, members, opts.maskPath, height, 2))
+                return 1;
+            sim->reset(queue);
+            sim->finish(queue);
+            std::cout << "ensemble of " << members.size() << " members" << std::endl;
+        } else {
+            sim.reset(new Simulation(context, program, width, height));
+            sim->initCellTypes(queue, mask, maskWidth, maskHeight, 2);
+            sim->wallDistance = wallDistance;
+            sim->reset(queue);
+            sim->finish(queue);
+        }
+
+        // out-of-core images are colormapped on the host, the lattice need not fit the device
+        std::unique_ptr<OffscreenRenderer> renderer;
+        if (!streamed)
+            renderer.reset(new OffscreenRenderer(context, queue, program, width, imageHeight, colormap, opts.outputFormat));
+
+        // batches end at the output steps, whose last step writes the visualization
+        long long step = 0;
+        Clock::time_point lastReportTime = Clock::now();
+        while (step < opts.steps) {
+            long long toOutput = opts.outputEvery - step % opts.outputEvery;
+            int steps = (int)std::min(toOutput, opts.steps - step);
+            bool output = steps == toOutput;
+
+            cl::Image * vis = output && renderer ? &renderer->vis : NULL;
+            std::string path = opts.outputPrefix + "_" + std::to_string(step + steps) + imageSuffix + "." + opts.outputFormat;
+            step += steps;
+            if (streamed) {
+                streamed->step(steps, output, visMode);
+                if (output && !streamed->writeImage(path, colormap, opts.outputFormat))
+                    std::cout << "Unable to write " << path << std::endl;
+            } else if (rankSlab) {
+                rankSlab->step(steps, vis, visMode);
+                if (output)
+                    renderer->write(rankSlab->queue(), rankSlab->visRangeDevice(), visMode, path);
+                rankSlab->finish();
+            } else if (slabs) {
+                slabs->step(steps, vis, visMode);
+                if (output)
+                    renderer->write(slabs->queue(), slabs->visRangeDevice(), visMode, path);
+                slabs->finish();
+            } else {
+                sim->step(queue, steps, -1.0f, -1.0f, vis, visMode);
+                if (output)
+                    renderer->write(queue, sim->visRangeDevice(), visMode, path);
+                sim->finish(queue);
+            }
+            if (renderer)
+                renderer->finish(queue);
+
+            if (std::chrono::duration<double>(Clock::now() - lastReportTime).count() >= 2.0) {
+                std::cout << "step " << step << " / " << opts.steps << std::endl;
+                std::vector<KernelStats *> stats = streamed ? streamed->stats() : rankSlab ? rankSlab->stats() :
+                                                   slabs ? slabs->stats() : sim->stats();
+                if (renderer)
+                    stats.push_back(&renderer->colorizeStats);
+                reportKernelStats(stats, copyBandwidth);
+                lastReportTime = Clock::now();
+            }
+        }
+        if (renderer)
+            renderer->close();
+    } catch(cl::Error err) {
+        std::cout << err.what() << "(" << err.err() << ")" << std::endl;
+        return 1;
+    } catch(std::runtime_error err) {
+        // a peer of a distributed run is gone
+        std::cout << err.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Successfully terminated!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+#include "options.h"
+
+// index of _name_ among nameOf(0) .. nameOf(count - 1), -1 if it is none of them
+int findName(const std::string & name, int count, const char * (*nameOf)(int));
+
+// Run the simulation without a window or GL context and write images of the flow
+// every opts.outputEvery steps. Returns the process exit code.
+int runHeadless(const Options & opts);
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#include "image_io.h"
+
+bool writePPM(const std::string & path, const unsigned char * rgba, int width, int height)
+{
+    FILE * file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row((size_t)width * 3);
+    for (int y = 0; y < height; y++) {
+        const unsigned char * src = rgba + (size_t)y * width * 4;
+        for (int x = 0; x < width; x++) {
+            row[3 * x] = src[4 * x];
+            row[3 * x + 1] = src[4 * x + 1];
+            row[3 * x + 2] = src[4 * x + 2];
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    return fclose(file) == 0;
+}
+
+static unsigned int crc32(unsigned int crc, const unsigned char * data, size_t size)
+{
+    static const std::vector<unsigned int> table = [] {
+        std::vector<unsigned int> t(256);
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void putBE32(std::vector<unsigned char> & out, unsigned int v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+static void writeChunk(FILE * file, const char * type, const std::vector<unsigned char> & data)
+{
+    std::vector<unsigned char> chunk;
+    putBE32(chunk, (unsigned int)data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBE32(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+bool writePNG(const std::string & path, const unsigned char * rgba, int width, int height)
+{
+    // raw scanlines: filter type 0, then RGB
+    size_t stride = (size_t)width * 3 + 1;
+    std::vector<unsigned char> raw(stride * height);
+    for (int y = 0; y < height; y++) {
+        unsigned char * dst = &raw[y * stride];
+        const unsigned char * src = rgba + (size_t)y * width * 4;
+        dst[0] = 0;
+        for (int x = 0; x < width; x++) {
+            dst[1 + 3 * x] = src[4 * x];
+            dst[2 + 3 * x] = src[4 * x + 1];
+            dst[3 + 3 * x] = src[4 * x + 2];
+        }
+    }
+
+    // zlib stream of stored deflate blocks
+    std::vector<unsigned char> idat = { 0x78, 0x01 };
+    size_t pos = 0;
+    do {
+        size_t len = std::min(raw.size() - pos, (size_t)65535);
+        bool last = pos + len == raw.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back((unsigned char)len);
+        idat.push_back((unsigned char)(len >> 8));
+        idat.push_back((unsigned char)~len);
+        idat.push_back((unsigned char)(~len >> 8));
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+    } while (pos < raw.size());
+    // adler32, reduced every 5552 bytes before the sums can overflow
+    unsigned int a = 1, b = 0;
+    for (size_t i = 0; i < raw.size(); ) {
+        size_t end = std::min(raw.size(), i + 5552);
+        for (; i < end; i++) {
+            a += raw[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    putBE32(idat, (b << 16) | a);
+
+    FILE * file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, sizeof(signature), file);
+
+    std::vector<unsigned char> header;
+    putBE32(header, (unsigned int)width);
+    putBE32(header, (unsigned int)height);
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });    // 8-bit RGB, no interlace
+    writeChunk(file, "IHDR", header);
+    writeChunk(file, "IDAT", idat);
+    writeChunk(file, "IEND", std::vector<unsigned char>());
+    return fclose(file) == 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Write an RGBA8 image (rows top-down, alpha dropped) as binary PPM or as PNG.
+// The PNG encoder stores uncompressed deflate blocks, it needs no zlib and costs
+// about as much as a copy. Both return false if the file cannot be written.
+bool writePPM(const std::string & path, const unsigned char * rgba, int width, int height);
+bool writePNG(const std::string & path, const unsigned char * rgba, int width, int height);
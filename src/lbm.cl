@@ -22,22 +22,57 @@ __constant float w[9] = { // 9 lattice constants
     1.0 / 36.0
 };
 
-__kernel void lbm(__read_only image2d_t boundary_tex, 
-                  __read_only image2d_t src_state_tex1,
-                  __read_only image2d_t src_state_tex2,
-                  __read_only image2d_t src_state_tex3,
-                  __write_only image2d_t dst_state_tex1,
-                  __write_only image2d_t dst_state_tex2,
-                  __write_only image2d_t dst_state_tex3,
-                  float tau,
-                  int image_size_x, int image_size_y,
-                  float mouse_loc_x, float mouse_loc_y)
+inline float equilibrium(int i, float rho, float2 u)
+{
+    float eu_dot = dot(e[i], u);
+    return w[i] * rho * (1.0f + 3.0f * eu_dot + 4.5f * eu_dot * eu_dot - 1.5f * dot(u, u));
+}
+
+// One stream-and-collide update of the cell at the global id. Returns the new
+// density, velocity and cell type for the visualization variant, skipped solid
+// tiles report CELL_SOLID.
+inline void lbmUpdate(__read_only image2d_t cell_type_tex,
+                      __global const uchar * tile_type,
+                      __global const uint * occupancy,
+                      int tiles_x, int occupancy_pitch,
+                      __read_only image2d_t src_state_tex1,
+                      __read_only image2d_t src_state_tex2,
+                      __read_only image2d_t src_state_tex3,
+                      __write_only image2d_t dst_state_tex1,
+                      __write_only image2d_t dst_state_tex2,
+                      __write_only image2d_t dst_state_tex3,
+                      float tau,
+                      float boundary_rho,
+                      float inlet_ux, float inlet_uy,
+                      int image_size_x, int image_size_y,
+                      float mouse_loc_x, float mouse_loc_y,
+                      __constant float4 * member_params, int member_size_y,
+                      __write_only image2d_t edge_tex, int edge_row0, int edge_row1,
+                      float * rho_out, float2 * u_out, uint * cell_type_out)
 {
     int idx_x = get_global_id(0);
     int idx_y = get_global_id(1);
 
+    // tiles match work-groups, so the whole group takes the same path
+    uchar tile = tile_type[(idx_y / TILE_DIM) * tiles_x + idx_x / TILE_DIM];
+    *cell_type_out = CELL_SOLID;
+    if (tile == TILE_SOLID)
+        return;
+
     if (idx_x < image_size_x && idx_y < image_size_y) {
         const sampler_t sample = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_LINEAR;
+        const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+        // an ensemble stacks its members vertically, each with its own
+        // (tau, boundary_rho, inlet_ux, inlet_uy); the solid margin of every
+        // member keeps the populations of its neighbours out
+        if (member_params) {
+            float4 params = member_params[idx_y / member_size_y];
+            tau = params.x;
+            boundary_rho = params.y;
+            inlet_ux = params.z;
+            inlet_uy = params.w;
+        }
 
         float f_star[9], f_new[9];
         float2 e_norm[9];
@@ -73,48 +108,681 @@ __kernel void lbm(__read_only image2d_t boundary_tex,
         }
         u /= rho;
 
-        float uu_dot = dot(u, u);
-        for (int i = 0; i < 9; i++) {
-            float eu_dot = dot(e[i], u);
-            f_new[i] = w[i] * rho * (1.0f + 3.0f * eu_dot + 4.5f * eu_dot * eu_dot - 1.5f * uu_dot); // f_eq
-            f_new[i] = f_star[i] - (f_star[i] - f_new[i]) / tau;
+        // fluid tiles skip the boundary checks, mixed tiles test the occupancy bit
+        // and only fetch the cell type of non-fluid cells
+        uint cell_type = CELL_FLUID;
+        if (tile == TILE_MIXED) {
+            uint word = occupancy[idx_y * occupancy_pitch + idx_x / 32];
+            if (!(word & (1u << (idx_x % 32))))
+                cell_type = read_imageui(cell_type_tex, sample_cell, pos).x;
         }
 
-        if (read_imagef(boundary_tex, sample, pos_norm).x > 0.5) {
-            // Node is 'Fluid'
-            write_imagef(dst_state_tex1, pos, (float4)(f_new[1], f_new[2], f_new[3], f_new[4]));
-            write_imagef(dst_state_tex2, pos, (float4)(f_new[5], f_new[6], f_new[7], f_new[8]));
-            write_imagef(dst_state_tex3, pos, (float4)(f_new[0], rho, u.x, u.y));
+        if (cell_type == CELL_FLUID) {
+            for (int i = 0; i < 9; i++) {
+                f_new[i] = f_star[i] - (f_star[i] - equilibrium(i, rho, u)) / tau;
+            }
+        } else if (cell_type == CELL_INLET) {
+            // prescribed velocity and density
+            rho = boundary_rho;
+            u = (float2)(inlet_ux, inlet_uy);
+            for (int i = 0; i < 9; i++) {
+                f_new[i] = equilibrium(i, rho, u);
+            }
+        } else if (cell_type == CELL_OUTLET) {
+            // prescribed density, velocity extrapolated from the incoming populations
+            rho = boundary_rho;
+            for (int i = 0; i < 9; i++) {
+                f_new[i] = equilibrium(i, rho, u);
+            }
+        }
+
+        float4 s1, s2, s3;
+        if (cell_type != CELL_SOLID) {
+            s1 = (float4)(f_new[1], f_new[2], f_new[3], f_new[4]);
+            s2 = (float4)(f_new[5], f_new[6], f_new[7], f_new[8]);
+            s3 = (float4)(f_new[0], rho, u.x, u.y);
         } else {
             // Node is 'Solid'
-            write_imagef(dst_state_tex1, pos, (float4)(f_star[3], f_star[4], f_star[1], f_star[2]));
-            write_imagef(dst_state_tex2, pos, (float4)(f_star[7], f_star[8], f_star[5], f_star[6]));
-            write_imagef(dst_state_tex3, pos, (float4)(f_star[0], rho, u.x, u.y));
+            s1 = (float4)(f_star[3], f_star[4], f_star[1], f_star[2]);
+            s2 = (float4)(f_star[7], f_star[8], f_star[5], f_star[6]);
+            s3 = (float4)(f_star[0], rho, u.x, u.y);
         }
+        write_imagef(dst_state_tex1, pos, s1);
+        write_imagef(dst_state_tex2, pos, s2);
+        write_imagef(dst_state_tex3, pos, s3);
+
+        // the edge rows again in an image of their own, which another queue reads
+        // while the rest of the step still writes the state images
+        for (int edge = 0; edge < 2; edge++) {
+            if (idx_y == (edge == 0 ? edge_row0 : edge_row1)) {
+                write_imagef(edge_tex, (int2)(idx_x, 3 * edge), s1);
+                write_imagef(edge_tex, (int2)(idx_x, 3 * edge + 1), s2);
+                write_imagef(edge_tex, (int2)(idx_x, 3 * edge + 2), s3);
+            }
+        }
+
+        *rho_out = rho;
+        *u_out = u;
+        *cell_type_out = cell_type;
     }
 }
 
+__kernel void lbm(__read_only image2d_t cell_type_tex,
+                  __global const uchar * tile_type,
+                  __global const uint * occupancy,
+                  int tiles_x, int occupancy_pitch,
+                  __read_only image2d_t src_state_tex1,
+                  __read_only image2d_t src_state_tex2,
+                  __read_only image2d_t src_state_tex3,
+                  __write_only image2d_t dst_state_tex1,
+                  __write_only image2d_t dst_state_tex2,
+                  __write_only image2d_t dst_state_tex3,
+                  float tau,
+                  float boundary_rho,
+                  float inlet_ux, float inlet_uy,
+                  int image_size_x, int image_size_y,
+                  float mouse_loc_x, float mouse_loc_y,
+                  __constant float4 * member_params,
+                  int member_size_y,
+                  __write_only image2d_t edge_tex,
+                  int edge_row0, int edge_row1)
+{
+    float rho;
+    float2 u;
+    uint cell_type;
+
+    lbmUpdate(cell_type_tex, tile_type, occupancy, tiles_x, occupancy_pitch,
+              src_state_tex1, src_state_tex2, src_state_tex3,
+              dst_state_tex1, dst_state_tex2, dst_state_tex3,
+              tau, boundary_rho, inlet_ux, inlet_uy,
+              image_size_x, image_size_y, mouse_loc_x, mouse_loc_y,
+              member_params, member_size_y,
+              edge_tex, edge_row0, edge_row1,
+              &rho, &u, &cell_type);
+}
+
+__kernel void lbmVis(__read_only image2d_t cell_type_tex,
+                     __global const uchar * tile_type,
+                     __global const uint * occupancy,
+                     int tiles_x, int occupancy_pitch,
+                     __read_only image2d_t src_state_tex1,
+                     __read_only image2d_t src_state_tex2,
+                     __read_only image2d_t src_state_tex3,
+                     __write_only image2d_t dst_state_tex1,
+                     __write_only image2d_t dst_state_tex2,
+                     __write_only image2d_t dst_state_tex3,
+                     float tau,
+                     float boundary_rho,
+                     float inlet_ux, float inlet_uy,
+                     int image_size_x, int image_size_y,
+                     float mouse_loc_x, float mouse_loc_y,
+                     __write_only image2d_t vis_tex,
+                     int vis_mode,
+                     __global float2 * vis_partial_range,
+                     int range_y0, int range_y1,
+                     __constant float4 * member_params,
+                     int member_size_y,
+                     __write_only image2d_t edge_tex,
+                     int edge_row0, int edge_row1,
+                     __global uint * non_finite)
+{
+    // lbm plus the selected visualization quantity in vis_tex.x and the
+    // fluid flag in vis_tex.y, so that drawing needs no extra pass.
+    // Each work-group also writes the (min, max) of the quantity over its
+    // fluid cells in rows [range_y0, range_y1), reduced further by reduceRange,
+    // and adds the number of those cells with a non-finite state to non_finite.
+
+    __local float2 range[TILE_DIM * TILE_DIM];
+    __local uint group_non_finite;
+
+    float rho = 0.0f;
+    float2 u = (float2)(0, 0);
+    uint cell_type;
+
+    lbmUpdate(cell_type_tex, tile_type, occupancy, tiles_x, occupancy_pitch,
+              src_state_tex1, src_state_tex2, src_state_tex3,
+              dst_state_tex1, dst_state_tex2, dst_state_tex3,
+              tau, boundary_rho, inlet_ux, inlet_uy,
+              image_size_x, image_size_y, mouse_loc_x, mouse_loc_y,
+              member_params, member_size_y,
+              edge_tex, edge_row0, edge_row1,
+              &rho, &u, &cell_type);
+
+    int idx_x = get_global_id(0);
+    int idx_y = get_global_id(1);
+    int local_idx = get_local_id(1) * TILE_DIM + get_local_id(0);
+
+    range[local_idx] = (float2)(INFINITY, -INFINITY);
+    if (local_idx == 0)
+        group_non_finite = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (idx_x < image_size_x && idx_y < image_size_y) {
+        float value = 0.0f;
+
+        if (cell_type != CELL_SOLID) {
+            if (vis_mode == VIS_VELOCITY) {
+                value = length(u);
+            } else if (vis_mode == VIS_PRESSURE) {
+                value = rho / 3.0f; // p = c_s^2 rho
+            } else {
+                // central differences of the velocity, neighbours from the previous step
+                // are still in cache from streaming
+                const sampler_t sample = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_LINEAR;
+                float2 image_size = (float2)((float)image_size_x, (float)image_size_y);
+                float2 pos_norm = ((float2)(idx_x, idx_y) + 0.5f) / image_size;
+                float2 dx = (float2)(1.0f / image_size.x, 0.0f), dy = (float2)(0.0f, 1.0f / image_size.y);
+                float2 u_e = read_imagef(src_state_tex3, sample, pos_norm + dx).zw;
+                float2 u_w = read_imagef(src_state_tex3, sample, pos_norm - dx).zw;
+                float2 u_n = read_imagef(src_state_tex3, sample, pos_norm + dy).zw;
+                float2 u_s = read_imagef(src_state_tex3, sample, pos_norm - dy).zw;
+                float2 du_dx = 0.5f * (u_e - u_w);
+                float2 du_dy = 0.5f * (u_n - u_s);
+
+                if (vis_mode == VIS_VORTICITY) {
+                    value = du_dx.y - du_dy.x;
+                } else {
+                    // Q = (|Omega|^2 - |S|^2) / 2
+                    value = -0.5f * (du_dx.x * du_dx.x + du_dy.y * du_dy.y) - du_dy.x * du_dx.y;
+                }
+            }
+        }
+
+        write_imagef(vis_tex, (int2)(idx_x, idx_y), (float4)(value, cell_type != CELL_SOLID ? 1.0f : 0.0f, 0.0f, 0.0f));
+        if (cell_type != CELL_SOLID && idx_y >= range_y0 && idx_y < range_y1) {
+            range[local_idx] = (float2)(value, value);
+            // min and max pass over NaN, so a partly diverged lattice still has a finite range
+            if (!isfinite(rho) || !isfinite(u.x) || !isfinite(u.y) || !isfinite(value))
+                atomic_inc(&group_non_finite);
+        }
+    }
+
+    // every work-item of the group gets here, skipped solid tiles included
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int s = TILE_DIM * TILE_DIM / 2; s > 0; s >>= 1) {
+        if (local_idx < s) {
+            float2 other = range[local_idx + s];
+            range[local_idx] = (float2)(min(range[local_idx].x, other.x), max(range[local_idx].y, other.y));
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    // indexed by tile rather than group, launches over bands of tiles use a global offset
+    if (local_idx == 0) {
+        vis_partial_range[(idx_y / TILE_DIM) * tiles_x + idx_x / TILE_DIM] = range[0];
+        if (group_non_finite > 0)
+            atomic_add(non_finite, group_non_finite);
+    }
+}
+
+__kernel void reduceRange(__global const float2 * partial_range,
+                          int n,
+                          __global float2 * vis_range)
+{
+    // single work-group of TILE_DIM * TILE_DIM: (min, max) over the per-group ranges of lbmVis
+
+    __local float2 range[TILE_DIM * TILE_DIM];
+    int local_idx = get_local_id(0);
+
+    float2 r = (float2)(INFINITY, -INFINITY);
+    for (int i = local_idx; i < n; i += TILE_DIM * TILE_DIM) {
+        float2 p = partial_range[i];
+        r = (float2)(min(r.x, p.x), max(r.y, p.y));
+    }
+    range[local_idx] = r;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int s = TILE_DIM * TILE_DIM / 2; s > 0; s >>= 1) {
+        if (local_idx < s) {
+            float2 other = range[local_idx + s];
+            range[local_idx] = (float2)(min(range[local_idx].x, other.x), max(range[local_idx].y, other.y));
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (local_idx == 0)
+        vis_range[0] = range[0];
+}
+
 __kernel void resetFluid(__write_only image2d_t state_tex1,
                          __write_only image2d_t state_tex2,
                          __write_only image2d_t state_tex3,
                          float init_rho,
-                         int image_size_x, int image_size_y)
+                         float init_ux, float init_uy,
+                         int image_size_x, int image_size_y,
+                         __constant float4 * member_params, int member_size_y)
 {
-    // set velocity as zero, rho as init_rho, f as f_eq
-    
+    // set velocity as (init_ux, init_uy), rho as init_rho, f as f_eq
+
     int idx_x = get_global_id(0);
     int idx_y = get_global_id(1);
 
     if (idx_x < image_size_x && idx_y < image_size_y) {
         int2 pos = (int2)(idx_x, idx_y);
+
+        // ensemble members start at their own density and inlet velocity
+        if (member_params) {
+            float4 params = member_params[idx_y / member_size_y];
+            init_rho = params.y;
+            init_ux = params.z;
+            init_uy = params.w;
+        }
+        float2 u = (float2)(init_ux, init_uy);
         float f[9];
 
         for (int i = 0; i < 9; i++) {
-            f[i] = w[i] * init_rho;
+            f[i] = equilibrium(i, init_rho, u);
         }
 
         write_imagef(state_tex1, pos, (float4)(f[1], f[2], f[3], f[4]));
         write_imagef(state_tex2, pos, (float4)(f[5], f[6], f[7], f[8]));
-        write_imagef(state_tex3, pos, (float4)(f[0], init_rho, 0, 0));
+        write_imagef(state_tex3, pos, (float4)(f[0], init_rho, u.x, u.y));
+    }
+}
+
+
+__kernel void streamCopy(__global const float4 * src,
+                         __global float4 * dst,
+                         int n)
+{
+    // STREAM-like copy used to measure attainable device bandwidth
+    int idx = get_global_id(0);
+
+    if (idx < n) {
+        dst[idx] = src[idx];
+    }
+}
+
+
+__kernel void resampleMask(__read_only image2d_t mask_tex,
+                           __write_only image2d_t cell_type_tex,
+                           int mask_size_x, int mask_size_y,
+                           int image_size_x, int image_size_y,
+                           int margin,
+                           int origin_y, int lattice_size_y)
+{
+    // area-weighted resampling of the mask cell types to the lattice: a cell is
+    // solid if at least half of its footprint is solid, otherwise it takes the
+    // open type covering the largest area. The image holds rows origin_y.. of a
+    // lattice_size_y high lattice, wrapping around like the lattice.
+
+    int idx_x = get_global_id(0);
+    int idx_y = get_global_id(1);
+
+    if (idx_x < image_size_x && idx_y < image_size_y) {
+        const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+        int2 pos = (int2)(idx_x, idx_y);
+        int lattice_y = ((idx_y + origin_y) % lattice_size_y + lattice_size_y) % lattice_size_y;
+        uint cell_type = CELL_SOLID;
+
+        // Cells near lattice margin are set to be boundary
+        if (idx_x >= margin && idx_x < image_size_x - margin && lattice_y >= margin && lattice_y < lattice_size_y - margin) {
+            float2 scale = (float2)((float)mask_size_x / image_size_x, (float)mask_size_y / lattice_size_y);
+            float2 p0 = (float2)(idx_x, lattice_y) * scale;
+            float2 p1 = p0 + scale;
+            float solid = 0.0f, fluid = 0.0f, inlet = 0.0f, outlet = 0.0f;
+
+            for (int my = (int)floor(p0.y); my < (int)ceil(p1.y); my++) {
+                float wy = fmin(p1.y, my + 1.0f) - fmax(p0.y, (float)my);
+                for (int mx = (int)floor(p0.x); mx < (int)ceil(p1.x); mx++) {
+                    float area = (fmin(p1.x, mx + 1.0f) - fmax(p0.x, (float)mx)) * wy;
+                    uint t = read_imageui(mask_tex, sample_cell, (int2)(mx, my)).x;
+                    if (t == CELL_FLUID)
+                        fluid += area;
+                    else if (t == CELL_INLET)
+                        inlet += area;
+                    else if (t == CELL_OUTLET)
+                        outlet += area;
+                    else
+                        solid += area;
+                }
+            }
+
+            if (solid < 0.5f * scale.x * scale.y) {
+                cell_type = CELL_FLUID;
+                if (inlet > fluid && inlet >= outlet)
+                    cell_type = CELL_INLET;
+                else if (outlet > fluid && outlet > inlet)
+                    cell_type = CELL_OUTLET;
+            }
+        }
+
+        write_imageui(cell_type_tex, pos, (uint4)(cell_type, 0, 0, 0));
+    }
+}
+
+// signed distances to primitives of the procedural geometry, negative inside
+float distanceCircle(float2 p, float2 c, float r)
+{
+    return length(p - c) - r;
+}
+
+float distanceRect(float2 p, float2 lo, float2 hi)
+{
+    float2 d = fabs(p - 0.5f * (lo + hi)) - 0.5f * (hi - lo);
+    return length(fmax(d, 0.0f)) + fmin(fmax(d.x, d.y), 0.0f);
+}
+
+float distancePolygon(float2 p, __global const float2 * v, int n)
+{
+    // distance to the nearest edge, the sign from the crossings of a ray along +x
+    float d2 = dot(p - v[0], p - v[0]);
+    float s = 1.0f;
+    for (int i = 0, j = n - 1; i < n; j = i, i++) {
+        float2 e = v[j] - v[i];
+        float2 w = p - v[i];
+        float2 b = w - e * clamp(dot(w, e) / fmax(dot(e, e), 1e-12f), 0.0f, 1.0f);
+        d2 = fmin(d2, dot(b, b));
+        bool c0 = p.y >= v[i].y, c1 = p.y < v[j].y, c2 = e.x * w.y > e.y * w.x;
+        if ((c0 && c1 && c2) || (!c0 && !c1 && !c2))
+            s = -s;
+    }
+    return s * sqrt(d2);
+}
+
+__kernel void rasterizeGeometry(__write_only image2d_t cell_type_tex,
+                                __write_only image2d_t distance_tex,
+                                int write_distance,
+                                __constant float8 * shapes, int shape_count,
+                                __global const float2 * vertices,
+                                float2 scale,
+                                int image_size_x, int image_size_y)
+{
+    // the shapes in order at the cell centre, _scale_ reference cells per cell: solid
+    // ones join the walls, fluid ones are cut out of them, inlets and outlets mark the
+    // open cells they cover. The distance is that of the walls, in cells.
+
+    int idx_x = get_global_id(0);
+    int idx_y = get_global_id(1);
+
+    if (idx_x < image_size_x && idx_y < image_size_y) {
+        int2 pos = (int2)(idx_x, idx_y);
+        float2 p = ((float2)(idx_x, idx_y) + 0.5f) * scale;
+        float wall = MAXFLOAT;
+        uint open_type = CELL_FLUID;
+
+        for (int i = 0; i < shape_count; i++) {
+            float8 shape = shapes[i];
+            int type = (int)shape.s0, kind = (int)shape.s1;
+            float d;
+            if (type == SHAPE_CIRCLE)
+                d = distanceCircle(p, shape.s23, shape.s4);
+            else if (type == SHAPE_RECT)
+                d = distanceRect(p, shape.s23, shape.s45);
+            else
+                d = distancePolygon(p, vertices + (int)shape.s2, (int)shape.s3);
+
+            if (kind == SHAPE_SOLID) {
+                wall = fmin(wall, d);
+            } else if (kind == SHAPE_FLUID) {
+                wall = fmax(wall, -d);
+                if (d < 0.0f)
+                    open_type = CELL_FLUID;
+            } else if (d < 0.0f) {
+                open_type = kind == SHAPE_INLET ? CELL_INLET : CELL_OUTLET;
+            }
+        }
+
+        write_imageui(cell_type_tex, pos, (uint4)(wall < 0.0f ? CELL_SOLID : open_type, 0, 0, 0));
+        if (write_distance)
+            write_imagef(distance_tex, pos, (float4)(wall / (0.5f * (scale.x + scale.y)), 0.0f, 0.0f, 0.0f));
+    }
+}
+
+__kernel void buildOccupancy(__read_only image2d_t cell_type_tex,
+                             __global uint * occupancy,
+                             int occupancy_pitch,
+                             int image_size_x, int image_size_y)
+{
+    // one work-item per 32-bit word of the fluid bitmap
+    int word_x = get_global_id(0);
+    int idx_y = get_global_id(1);
+
+    if (word_x < occupancy_pitch && idx_y < image_size_y) {
+        const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+        uint word = 0;
+
+        for (int b = 0; b < 32; b++) {
+            int x = word_x * 32 + b;
+            if (x < image_size_x && read_imageui(cell_type_tex, sample_cell, (int2)(x, idx_y)).x == CELL_FLUID)
+                word |= 1u << b;
+        }
+        occupancy[idx_y * occupancy_pitch + word_x] = word;
+    }
+}
+
+__kernel void summarizeTiles(__read_only image2d_t cell_type_tex,
+                             __global uchar * tile_type,
+                             __global int * tile_count,
+                             int tiles_x, int tiles_y,
+                             int image_size_x, int image_size_y)
+{
+    // one work-item per TILE_DIM x TILE_DIM tile. A tile is solid only together with
+    // its one-cell ring (wrapping like the REPEAT sampler of lbm), otherwise fluid
+    // neighbours would stream into cells that are never updated.
+    int tile_x = get_global_id(0);
+    int tile_y = get_global_id(1);
+
+    if (tile_x < tiles_x && tile_y < tiles_y) {
+        const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+        int x0 = tile_x * TILE_DIM, y0 = tile_y * TILE_DIM;
+        int x1 = min(x0 + TILE_DIM, image_size_x), y1 = min(y0 + TILE_DIM, image_size_y);
+        bool all_fluid = true, all_solid = true;
+
+        for (int y = y0 - 1; y <= y1; y++) {
+            for (int x = x0 - 1; x <= x1; x++) {
+                int2 cell = (int2)((x + image_size_x) % image_size_x, (y + image_size_y) % image_size_y);
+                uint t = read_imageui(cell_type_tex, sample_cell, cell).x;
+                bool inside = x >= x0 && x < x1 && y >= y0 && y < y1;
+                if (inside && t != CELL_FLUID)
+                    all_fluid = false;
+                if (t != CELL_SOLID)
+                    all_solid = false;
+            }
+        }
+
+        uchar type = all_fluid ? TILE_FLUID : (all_solid ? TILE_SOLID : TILE_MIXED);
+        tile_type[tile_y * tiles_x + tile_x] = type;
+        atomic_inc(&tile_count[type]);
+    }
+}
+
+inline uint hashUint(uint x)
+{
+    // integer hash for particle respawn positions
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline float hashFloat(uint * state)
+{
+    *state = hashUint(*state);
+    return (float)(*state >> 8) * (1.0f / 16777216.0f);
+}
+
+__kernel void advectParticles(__global const float4 * src_particles,
+                              __global float4 * dst_particles,
+                              __global uint * live_count,
+                              __read_only image2d_t cell_type_tex,
+                              __read_only image2d_t state_tex3,
+                              int n,
+                              int steps,
+                              float lifetime,
+                              int image_size_x, int image_size_y)
+{
+    // particle = (x, y, age, 0) in lattice units, cell i covering [i, i + 1) as in
+    // licVelocity: the unnormalized linear sampler puts the centre of texel i at i + 0.5,
+    // so sampling at the particle position itself interpolates between cell centres.
+    // Midpoint integration through the velocity, which is held fixed over the _steps_ of
+    // a batch, in substeps of at most about a cell (steps * |u| of them), so that
+    // particles cannot jump over thin walls; one that enters a solid cell is dropped.
+    // Live particles are compacted to the front of dst_particles.
+
+    int idx = get_global_id(0);
+    if (idx >= n)
+        return;
+
+    const sampler_t sample = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+    const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+    float4 p = src_particles[idx];
+    bool alive = true;
+    float remaining = (float)steps;
+    while (alive && remaining > 0.0f) {
+        float2 u1 = read_imagef(state_tex3, sample, p.xy).zw;
+        // slow particles take substeps of up to 4 steps, a diverged velocity above 4 cells
+        // per step still finishes in 4 * steps substeps
+        float dt = fmin(remaining, 1.0f / clamp(length(u1), 0.25f, 4.0f));
+        float2 u2 = read_imagef(state_tex3, sample, p.xy + 0.5f * dt * u1).zw;
+        p.xy += dt * u2;
+        remaining -= dt;
+
+        alive = p.x >= 0.0f && p.y >= 0.0f && p.x < image_size_x && p.y < image_size_y;
+        if (alive)
+            alive = read_imageui(cell_type_tex, sample_cell, convert_int2(p.xy)).x != CELL_SOLID;
+    }
+    p.z += (float)steps;
+
+    if (alive && p.z < lifetime)
+        dst_particles[atomic_inc(live_count)] = p;
+}
+
+__kernel void respawnParticles(__global float4 * particles,
+                               __global const uint * live_count,
+                               __read_only image2d_t cell_type_tex,
+                               int n,
+                               uint seed,
+                               float lifetime,
+                               int random_age,
+                               int image_size_x, int image_size_y)
+{
+    // fill the slots behind the live particles with new ones at random non-solid cells
+
+    int idx = get_global_id(0);
+    if (idx >= n || (uint)idx < live_count[0])
+        return;
+
+    const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+    uint state = hashUint((uint)idx ^ hashUint(seed));
+    float2 pos;
+    for (int tries = 0; tries < 16; tries++) {
+        pos = (float2)(hashFloat(&state) * image_size_x, hashFloat(&state) * image_size_y);
+        if (read_imageui(cell_type_tex, sample_cell, convert_int2(pos)).x != CELL_SOLID)
+            break;
+    }
+
+    // spread the ages of the initial particles so they do not expire together
+    float age = random_age ? hashFloat(&state) * lifetime : 0.0f;
+    particles[idx] = (float4)(pos.x, pos.y, age, 0.0f);
+}
+
+// the halo of the local tile covers the streamline half length LIC_LENGTH
+// plus one cell for bilinear sampling
+#define LIC_HALO (LIC_LENGTH + 2)
+#define LIC_TILE (TILE_DIM + 2 * LIC_HALO)
+
+inline float2 licVelocity(__local const float2 * tile_u, float2 p)
+{
+    // bilinear velocity at tile position p, cell centers at integer + 0.5
+    float2 q = clamp(p - 0.5f, 0.0f, (float)(LIC_TILE - 1) - 1e-3f);
+    int2 i = convert_int2(q);
+    float2 a = q - convert_float2(i);
+    float2 u00 = tile_u[i.y * LIC_TILE + i.x], u10 = tile_u[i.y * LIC_TILE + i.x + 1];
+    float2 u01 = tile_u[(i.y + 1) * LIC_TILE + i.x], u11 = tile_u[(i.y + 1) * LIC_TILE + i.x + 1];
+    return mix(mix(u00, u10, a.x), mix(u01, u11, a.x), a.y);
+}
+
+__kernel void lineIntegralConvolution(__read_only image2d_t state_tex3,
+                                      __write_only image2d_t lic_tex,
+                                      int image_size_x, int image_size_y)
+{
+    // box filter of white noise along the streamline through each cell. Velocity and
+    // noise of the work-group tile and its halo are staged in local memory, so the
+    // 2 * LIC_LENGTH samples per cell do not go to global memory.
+
+    __local float2 tile_u[LIC_TILE * LIC_TILE];
+    __local float tile_noise[LIC_TILE * LIC_TILE];
+
+    const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+    int2 origin = (int2)(get_group_id(0) * TILE_DIM - LIC_HALO, get_group_id(1) * TILE_DIM - LIC_HALO);
+    int local_idx = get_local_id(1) * TILE_DIM + get_local_id(0);
+
+    for (int i = local_idx; i < LIC_TILE * LIC_TILE; i += TILE_DIM * TILE_DIM) {
+        int2 cell = origin + (int2)(i % LIC_TILE, i / LIC_TILE);
+        tile_u[i] = read_imagef(state_tex3, sample_cell, cell).zw;
+        // noise is a hash of the cell, no texture needed. It stays the same from frame to
+        // frame, so that the image only changes where the flow does.
+        uint clamped_x = (uint)clamp(cell.x, 0, image_size_x - 1);
+        uint clamped_y = (uint)clamp(cell.y, 0, image_size_y - 1);
+        tile_noise[i] = (float)(hashUint(clamped_y * (uint)image_size_x + clamped_x) >> 8) * (1.0f / 16777216.0f);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int idx_x = get_global_id(0);
+    int idx_y = get_global_id(1);
+    if (idx_x >= image_size_x || idx_y >= image_size_y)
+        return;
+
+    float2 start = (float2)(get_local_id(0) + LIC_HALO + 0.5f, get_local_id(1) + LIC_HALO + 0.5f);
+    float sum = tile_noise[(int)start.y * LIC_TILE + (int)start.x];
+    int count = 1;
+
+    // unit steps forward and backward along the normalized velocity
+    for (int dir = -1; dir <= 1; dir += 2) {
+        float2 p = start;
+        for (int s = 0; s < LIC_LENGTH; s++) {
+            float2 u = licVelocity(tile_u, p);
+            float speed = length(u);
+            if (speed < 1e-6f)
+                break;
+            p += (float)dir * u / speed;
+            sum += tile_noise[(int)p.y * LIC_TILE + (int)p.x];
+            count++;
+        }
+    }
+
+    // averaging reduces the contrast of the noise by sqrt(count), restore some of it
+    float lic = clamp(0.5f + (sum / count - 0.5f) * 0.5f * sqrt((float)count), 0.0f, 1.0f);
+    write_imagef(lic_tex, (int2)(idx_x, idx_y), (float4)(lic, 0.0f, 0.0f, 0.0f));
+}
+
+__kernel void colorize(__read_only image2d_t vis_tex,
+                       __global const float2 * vis_range,
+                       __global const uchar4 * colormap,
+                       int colormap_size,
+                       int symmetric,
+                       __global uchar4 * rgba,
+                       int image_size_x, int image_size_y)
+{
+    // render.frag for offscreen images: the quantity in vis_tex.x mapped through the
+    // colormap over the range reduced by reduceRange, solid cells black. Rows are
+    // written top-down as image files expect.
+
+    int idx_x = get_global_id(0);
+    int idx_y = get_global_id(1);
+    if (idx_x >= image_size_x || idx_y >= image_size_y)
+        return;
+
+    const sampler_t sample_cell = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+    float4 vis = read_imagef(vis_tex, sample_cell, (int2)(idx_x, idx_y));
+
+    uchar4 color = (uchar4)(0, 0, 0, 255);
+    if (vis.y > 0.5f) {
+        float2 range = vis_range[0];
+        if (symmetric) {
+            range.y = fmax(fabs(range.x), fabs(range.y));
+            range.x = -range.y;
+        }
+        float t = clamp((vis.x - range.x) / fmax(range.y - range.x, 1e-9f), 0.0f, 1.0f);
+        float x = t * (colormap_size - 1);
+        int i = min((int)x, colormap_size - 2);
+        float4 c = mix(convert_float4(colormap[i]), convert_float4(colormap[i + 1]), x - i);
+        color = convert_uchar4_sat_rte(c);
+        color.w = 255;
     }
+    rgba[(image_size_y - 1 - idx_y) * image_size_x + idx_x] = color;
 }
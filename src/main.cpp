@@ -2,6 +2,11 @@
 #include <vector>
 #include <cstdlib>
 #include <tuple>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cmath>
 
 #define GLFW_INCLUDE_NONE         // to solve conflict of glfw3native and glad
 #define GLFW_EXPOSE_NATIVE_WIN32
@@ -13,15 +18,40 @@
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 #include "cl_util.h"
+#include "cell_type.h"
+#include "perf_util.h"
+#include "capture.h"
+#include "display_readback.h"
+#include "footprint.h"
+#include "colormap.h"
+#include "options.h"
+#include "geometry.h"
+#include "mask.h"
+#include "headless.h"
+#include "sweep.h"
+#include "simulation.h"
+#include "particles.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
 #include "shader.h"
 
-// CL threadblock config
-#define THREAD_PER_BLOCK_DIM 16
-#define NUM_BLOCKS(n, block_size) (((n) + (block_size) - 1) / (block_size))
 
+// input events sent from the GL thread to the simulation thread
+struct InputEvent {
+    enum Type { RESET, INJECT, VIS_MODE, LIC } type;
+    float x, y;     // INJECT: lattice position, negative to stop injecting
+    int mode = 0;   // VIS_MODE: displayed quantity, LIC: 1 to overlay the convolution
+};
+
+// range of each displayed quantity mapped to the color scale when auto-ranging is off
+const float visRange[VIS_MODE_COUNT][2] = {
+    { 0.0f, 0.4f },         // VIS_VELOCITY
+    { -0.05f, 0.05f },      // VIS_VORTICITY
+    { 0.3f, 0.37f },        // VIS_PRESSURE
+    { -1e-3f, 1e-3f },      // VIS_QCRITERION
+};
+#define COLORMAP_SIZE 256
 
 // **************** global variables ****************
 GLFWwindow * window;
@@ -29,59 +59,243 @@ cl::Device device;
 cl::Context context;
 cl::CommandQueue queue;
 cl::Program program;
-cl::Kernel kernel, kernelReset;
-
-const float tau = 0.58;
-const float uxInit = 0.3, uyInit = 0.06;
-const float rhoInit = 1.0;
+Options opts;
+Simulation sim;
+Particles particles;
 
-int winWidth = 0, winHeight = 0;
+int latticeWidth = 0, latticeHeight = 0;
+int maskWidth = 0, maskHeight = 0;
+int viewX = 0, viewY = 0, viewWidth = 0, viewHeight = 0; // lattice area of the framebuffer
 unsigned int VBO, VAO, EBO;
-unsigned int lbmBoundary;
-unsigned int lbmBuffer[2][3]; // double buffer, one for read, one for write
-cl::ImageGL lbmGLBoundary;
-cl::ImageGL lbmGLBuffer[2][3];
+cl::Image2D lbmMask; // cell types at mask resolution, resampled to the lattice on device
+
+// display images, triple buffered between the simulation thread (writer) and the GL thread.
+// CL writes the GL textures through cl::ImageGL, or without GL sharing writes plain images
+// that are read back and uploaded, see DisplayReadback.
+bool interop = true;
+DisplayReadback readback;
+unsigned int displayTex[3];
+cl::ImageGL displayGL[3];
+cl::Image2D displayHost[3];
+cl::Image * displayCL[3];             // displayGL or displayHost
+GLsync displayFence[3] = { 0, 0, 0 }; // last draw reading each slot
+TripleBuffer displaySlots;
+int displayMode[3] = { 0, 0, 0 };     // quantity in each slot, written before it is published
+float displayRange[3][2];             // (min, max) of the quantity over the fluid, likewise
+bool displayLic[3] = { false, false, false }; // line integral convolution written, likewise
+unsigned int licTex[3];
+cl::ImageGL licGL[3];
+cl::Image2D licHost[3];
+cl::Image * licCL[3];
+
+// tracer particle vertex buffers, one per display slot
+unsigned int particleVBO[3], particleVAO[3];
+cl::BufferGL particleGL[3];           // only with GL sharing
+
+// simulation thread
+std::thread simThread;
+std::atomic<bool> simRunning{false};
+SpscQueue<InputEvent, 256> inputQueue;
+std::atomic<long long> stepCount{0};
+std::atomic<double> renderSeconds{0.0}; // GPU time of the last measured frame
 
 // FPS computation
 double lastTime = 0.0f;
 int nbFrames = 0;
+
+// GL thread state
+bool resetKeyDown = false, colormapKeyDown = false, rangeKeyDown = false, injecting = false;
+int visKeyDown = -1;
+unsigned int colormapTex[COLORMAP_COUNT];
+int visColormap[VIS_MODE_COUNT] = { COLORMAP_VIRIDIS, COLORMAP_COOLWARM, COLORMAP_VIRIDIS, COLORMAP_COOLWARM };
+bool autoRange = true;
+bool particleKeyDown = false, showParticles = true;
+bool licKeyDown = false, showLic = false;
+bool mipmapsValid[3] = { false, false, false };   // of the display and LIC textures of each slot
+
+// camera over the lattice in texture coordinates, zoom 1 shows the whole lattice
+float zoom = 1.0f, centerX = 0.5f, centerY = 0.5f;
+bool panning = false, viewKeyDown = false;
+double panLastX = 0.0, panLastY = 0.0;
+float injectX = -1.0f, injectY = -1.0f;
+bool redraw = false;
+unsigned int renderQuery;
+bool renderQueryPending = false;
+
+// recording of the drawn frames
+FrameCapture capture;
+bool captureDone = false;
+
+// bandwidth reporting
+double copyBandwidth = 0.0;
 // **************************************************
 
+void fitViewport(int width, int height) {
+    // largest area of the framebuffer with the aspect ratio of the lattice
+    float latticeAspect = (float)latticeWidth / latticeHeight;
+    viewWidth = width;
+    viewHeight = (int)(width / latticeAspect);
+    if (viewHeight > height) {
+        viewHeight = height;
+        viewWidth = (int)(height * latticeAspect);
+    }
+    viewX = (width - viewWidth) / 2;
+    viewY = (height - viewHeight) / 2;
+}
+
 void framebuffer_size_callback(GLFWwindow * window, int width, int height) {
-    glViewport(0, 0, width, height);
+    fitViewport(width, height);
+    redraw = true;
 }
 
-bool processInput(GLFWwindow *window) {
-    // returns whether to reset fluid state
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
-    else if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
-        return true;
-    return false;
+void viewRect(float rect[4]) {
+    // visible part of the lattice in texture coordinates: origin and size
+    float size = 1.0f / zoom;
+    rect[0] = centerX - 0.5f * size;
+    rect[1] = centerY - 0.5f * size;
+    rect[2] = rect[3] = size;
+}
+
+void clampCamera() {
+    // keep the visible part inside the lattice
+    float half = 0.5f / zoom;
+    centerX = std::min(1.0f - half, std::max(half, centerX));
+    centerY = std::min(1.0f - half, std::max(half, centerY));
+}
+
+std::tuple<double, double> getCursorViewPos(GLFWwindow *window) {
+    // cursor position relative to the lattice viewport, (0, 0) bottom left and (1, 1) top right
+    double xpos, ypos;
+    int winW, winH, fbW, fbH;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    glfwGetWindowSize(window, &winW, &winH);
+    glfwGetFramebufferSize(window, &fbW, &fbH);
+    // cursor is in screen coordinates, the viewport in framebuffer pixels
+    double fbX = xpos * fbW / winW, fbY = (winH - ypos) * fbH / winH;
+    return {(fbX - viewX) / viewWidth, (fbY - viewY) / viewHeight};
+}
+
+void scroll_callback(GLFWwindow * window, double xoffset, double yoffset) {
+    // zoom around the cursor, up to 32 screen pixels per lattice cell
+    auto [u, v] = getCursorViewPos(window);
+    float rect[4];
+    viewRect(rect);
+    float pointX = rect[0] + (float)u * rect[2], pointY = rect[1] + (float)v * rect[3];
+
+    float maxZoom = std::max(1.0f, 32.0f * latticeWidth / std::max(1, viewWidth));
+    zoom = std::min(maxZoom, std::max(1.0f, zoom * std::pow(1.25f, (float)yoffset)));
+    centerX = pointX - ((float)u - 0.5f) / zoom;
+    centerY = pointY - ((float)v - 0.5f) / zoom;
+    clampCamera();
+    redraw = true;
 }
 
 std::tuple<double, double> getMouseClickPos(GLFWwindow *window) {
+    // returns the lattice cell under the cursor, y pointing up
     if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
-        double xpos, ypos;
-        glfwGetCursorPos(window, &xpos, &ypos);
-        return {xpos, ypos};
+        auto [u, v] = getCursorViewPos(window);
+        float rect[4];
+        viewRect(rect);
+        return {(rect[0] + u * rect[2]) * latticeWidth,
+                (rect[1] + v * rect[3]) * latticeHeight};
     } else
         return {-1, -1};
 }
 
-void showFPS(GLFWwindow * window, double interval = 0.1f) {
+bool keyPressed(GLFWwindow *window, int key, bool & down) {
+    // true once per key press
+    bool pressed = glfwGetKey(window, key) == GLFW_PRESS;
+    bool edge = pressed && !down;
+    down = pressed;
+    return edge;
+}
+
+void processInput(GLFWwindow *window) {
+    // forwards input to the simulation thread, events are dropped if it falls behind
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+
+    if (keyPressed(window, GLFW_KEY_R, resetKeyDown))
+        inputQueue.push({ InputEvent::RESET, 0.0f, 0.0f });
+
+    // C cycles the colormap of the displayed quantity, A toggles auto-ranging
+    if (keyPressed(window, GLFW_KEY_C, colormapKeyDown)) {
+        int & map = visColormap[displayMode[displaySlots.front()]];
+        map = (map + 1) % COLORMAP_COUNT;
+        std::cout << "colormap: " << colormapName(map) << std::endl;
+        redraw = true;
+    }
+    if (keyPressed(window, GLFW_KEY_A, rangeKeyDown)) {
+        autoRange = !autoRange;
+        redraw = true;
+    }
+    // right mouse button drags the view, 0 shows the whole lattice again
+    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+        auto [u, v] = getCursorViewPos(window);
+        if (panning && (u != panLastX || v != panLastY)) {
+            centerX -= (float)(u - panLastX) / zoom;
+            centerY -= (float)(v - panLastY) / zoom;
+            clampCamera();
+            redraw = true;
+        }
+        panning = true;
+        panLastX = u;
+        panLastY = v;
+    } else {
+        panning = false;
+    }
+    if (keyPressed(window, GLFW_KEY_0, viewKeyDown)) {
+        zoom = 1.0f;
+        centerX = centerY = 0.5f;
+        redraw = true;
+    }
+
+    if (keyPressed(window, GLFW_KEY_L, licKeyDown)) {
+        showLic = !showLic;
+        inputQueue.push({ InputEvent::LIC, 0.0f, 0.0f, showLic ? 1 : 0 });
+    }
+    if (keyPressed(window, GLFW_KEY_P, particleKeyDown)) {
+        showParticles = !showParticles;
+        redraw = true;
+    }
+
+    // keys 1 to 4 select the displayed quantity
+    int visKey = -1;
+    for (int i = 0; i < VIS_MODE_COUNT; i++)
+        if (glfwGetKey(window, GLFW_KEY_1 + i) == GLFW_PRESS)
+            visKey = i;
+    if (visKey >= 0 && visKey != visKeyDown)
+        inputQueue.push({ InputEvent::VIS_MODE, 0.0f, 0.0f, visKey });
+    visKeyDown = visKey;
+
+    auto [mouse_x, mouse_y] = getMouseClickPos(window);
+    if (mouse_x >= 0.0) {
+        if (!injecting || (float)mouse_x != injectX || (float)mouse_y != injectY) {
+            injectX = (float)mouse_x;
+            injectY = (float)mouse_y;
+            injecting = inputQueue.push({ InputEvent::INJECT, injectX, injectY });
+        }
+    } else if (injecting) {
+        injecting = !inputQueue.push({ InputEvent::INJECT, -1.0f, -1.0f });
+    }
+}
+
+void showFPS(GLFWwindow * window, double interval = 0.5f) {
+     static long long lastStepCount = 0;
      double currentTime = glfwGetTime();
      double delta = currentTime - lastTime;
-     nbFrames++;
      if (delta >= interval) { 
+        long long steps = stepCount.load();
         double fps = double(nbFrames) / delta;
+        double sps = double(steps - lastStepCount) / delta;
 
         std::stringstream ss;
-        ss << "LBM" << " [" << fps << " FPS]";
+        ss << "LBM" << " [" << fps << " FPS, " << sps << " steps/s]";
 
         glfwSetWindowTitle(window, ss.str().c_str());
 
         nbFrames = 0;
+        lastStepCount = steps;
         lastTime = currentTime;
      }
 }
@@ -94,7 +308,7 @@ void initGL() {
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     // glfw window creation
-    window = glfwCreateWindow(800, 600, "LBM", NULL, NULL);
+    window = glfwCreateWindow(opts.windowWidth, opts.windowHeight, "LBM", NULL, NULL);
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -102,8 +316,9 @@ void initGL() {
     }
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    // set vsync, make sure the simulation won't go too fast
-    glfwSwapInterval(1);
+    glfwSetScrollCallback(window, scroll_callback);
+    // no vsync, frames are paced by the simulation thread
+    glfwSwapInterval(0);
     // glad: load all OpenGL function pointers
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         std::cout << "Failed to initialize GLAD" << std::endl;
@@ -111,128 +326,108 @@ void initGL() {
     }
 }
 
+void allocateMipmaps(GLenum internalFormat, GLenum format, GLenum type) {
+    // storage of every mip level of the bound lattice-sized texture. Levels are only filled
+    // by glGenerateMipmap, which then never reallocates a texture shared with CL.
+    int levels = 1;
+    while ((latticeWidth >> levels) > 0 || (latticeHeight >> levels) > 0)
+        levels++;
+    for (int level = 0; level < levels; level++)
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, std::max(1, latticeWidth >> level),
+                     std::max(1, latticeHeight >> level), 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
 bool initFluidState(const char * imagePath) {
-    // load image
-    int nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char * maskData = stbi_load(imagePath, &winWidth, &winHeight, &nrChannels, 0);
-    std::cout << "texture image (HxW):" << winHeight << " x " << winWidth << std::endl;
-
-    // Fill _boundaryData_ with image data from _boundaryBitmap_
-    float * boundaryData = new float[winWidth * winHeight * 3];
-    if (boundaryData == NULL) {
-        std::cout << "Unable to allocate memory!" << std::endl;
+    if (!maskSize(imagePath, maskWidth, maskHeight))
         return false;
-    }
-    for (int y = 0; y < winHeight; y++) {
-        for (int x = 0; x < winWidth; x++) {
-            int index = y * winWidth + x;
-            // Pixels near image margin are set to be boundary 
-            if ((x < 2) || (x > (winWidth - 3)) || (y < 2) || (y > (winHeight - 3))) {
-                boundaryData[3 * index + 0] = 0.0f;
-                boundaryData[3 * index + 1] = 0.0f;
-                boundaryData[3 * index + 2] = 0.0f;
-            } else {
-                // pixels: 0.0 or 1.0
-                unsigned char r = maskData[3 * index + 0];
-                unsigned char g = maskData[3 * index + 1];
-                unsigned char b = maskData[3 * index + 2];
-                boundaryData[3 * index + 0] = r / 255.0;
-                boundaryData[3 * index + 1] = g / 255.0;
-                boundaryData[3 * index + 2] = b / 255.0;
-            }
-        }
-    }
-    stbi_image_free(maskData);
-    // generate OpenGL texture buffer for Boundary data
-    glGenTextures(1, &lbmBoundary);
-    glBindTexture(GL_TEXTURE_2D, lbmBoundary);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, winWidth, winHeight, 0, GL_RGB, GL_FLOAT, boundaryData);
-
-    // initialize the data buffers for LBM simulation use
-    float * lbmData[4];
-    for (int i = 0; i < 4; i++)
-    {
-        lbmData[i] = new float[winWidth * winHeight * 4];
-        if (lbmData[i] == NULL)
+    latticeSize(opts, maskWidth, maskHeight, latticeWidth, latticeHeight);
+
+    // plan the memory before allocating any of it, a lattice too large is shrunk with --auto-fit
+    RunShape shape;
+    shape.width = latticeWidth;
+    shape.height = latticeHeight;
+    shape.maskWidth = maskWidth;
+    shape.maskHeight = maskHeight;
+    shape.images = false;
+    shape.display = true;
+    shape.displayReadback = !interop;
+    shape.particles = opts.particles;
+    shape.wallDistance = isGeometryPath(imagePath);
+    MemoryLimits limits = memoryLimits(std::vector<cl::Device>(1, device));
+    if (!checkFootprint(computeFootprint(shape), limits)) {
+        if (!opts.autoFit || !fitFootprint(shape, limits)) {
+            std::cout << "The lattice does not fit" << (opts.autoFit ? "" : ", --auto-fit shrinks it") << std::endl;
             return false;
+        }
+        latticeWidth = shape.width;
+        latticeHeight = shape.height;
+        std::cout << "fitted to lattice (HxW): " << latticeHeight << " x " << latticeWidth << std::endl;
+        checkFootprint(computeFootprint(shape), limits);
     }
-    // dummy data for initializing the second copy of butter
-    memset(lbmData[3], 0, winWidth * winHeight * 4 * sizeof(float));
-
-    // initialize distribution function
-    float w[9] = { 4.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 
-                   1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f };
-    float e[9][2] = { { 0,0 }, { 1,0 }, { 0,1 }, { -1,0 }, { 0,-1 }, 
-                      { 1,1 }, { -1,1 }, { -1,-1 }, { 1,-1 } };
-    // initialize values of f0-f8, rho, ux, uy for each pixel
-    for (int y = 0; y < winHeight; y++) {
-        for (int x = 0; x < winWidth; x++) {
-            float ux = uxInit;
-            float uy = uyInit;
-            float rho = rhoInit;
-            float uu_dot = (ux * ux + uy * uy);
-            float f[9];
-            for (int i = 0; i < 9; i++) {
-                float eu_dot = (e[i][0] * ux + e[i][1] * uy);
-                f[i] = w[i] * rho * (1.0f + 3.0f * eu_dot + 4.5f * eu_dot * eu_dot - 1.5f * uu_dot);
-            }
 
-            int index = y * winWidth + x;
-            //! f1~f4
-            lbmData[0][4 * index + 0] = f[1];
-            lbmData[0][4 * index + 1] = f[2];
-            lbmData[0][4 * index + 2] = f[3];
-            lbmData[0][4 * index + 3] = f[4];
-            //! f5~f8
-            lbmData[1][4 * index + 0] = f[5];
-            lbmData[1][4 * index + 1] = f[6];
-            lbmData[1][4 * index + 2] = f[7];
-            lbmData[1][4 * index + 3] = f[8];
-            //! f0, rho, and (ux,uy)
-            lbmData[2][4 * index + 0] = f[0];
-            lbmData[2][4 * index + 1] = rho;
-            lbmData[2][4 * index + 2] = ux;
-            lbmData[2][4 * index + 3] = uy;
-        }
+    try {
+        cl::Image2D wallDistance;
+        if (!loadLatticeMask(context, queue, program, imagePath, latticeWidth, latticeHeight, lbmMask, maskWidth, maskHeight,
+                             &wallDistance))
+            return false;
+        // the lattice state lives in plain CL images owned by the simulation
+        sim = Simulation(context, program, latticeWidth, latticeHeight);
+        sim.wallDistance = wallDistance;
+        if (opts.particles > 0)
+            particles = Particles(context, program, opts.particles);
+    } catch(cl::Error err) {
+        std::cout << err.what() << "(" << err.err() << ")" << std::endl;
+        return false;
     }
 
-    // generate OpenGL texture buffer for lbmBuffer[3]
+    // display images shared with CL, only these are touched by both APIs
     for (int i = 0; i < 3; i++) {
-        glGenTextures(1, &lbmBuffer[0][i]);
-        glBindTexture(GL_TEXTURE_2D, lbmBuffer[0][i]);
+        glGenTextures(1, &displayTex[i]);
+        glBindTexture(GL_TEXTURE_2D, displayTex[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        //! set GL_RGBA as internal format for data storage
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, winWidth, winHeight, 0, GL_RGBA, GL_FLOAT, lbmData[i]);
-    }
-    // generate texture for the double buffer
-    for (int i = 0; i < 3; i++) {
-        glGenTextures(1, &lbmBuffer[1][i]);
-        glBindTexture(GL_TEXTURE_2D, lbmBuffer[1][i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        allocateMipmaps(GL_RGBA32F, GL_RGBA, GL_FLOAT);
+
+        glGenTextures(1, &licTex[i]);
+        glBindTexture(GL_TEXTURE_2D, licTex[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        //! set GL_RGBA as internal format for data storage
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, winWidth, winHeight, 0, GL_RGBA, GL_FLOAT, lbmData[3]); // dummy data
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        allocateMipmaps(GL_R8, GL_RED, GL_UNSIGNED_BYTE);
+    }
+
+    // particle vertex buffers shared with CL, drawn as points
+    glGenVertexArrays(3, particleVAO);
+    glGenBuffers(3, particleVBO);
+    for (int i = 0; i < 3; i++) {
+        glBindVertexArray(particleVAO[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, particleVBO[i]);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)std::max(1, particles.count) * 4 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+    }
+    glBindVertexArray(0);
+
+    // colormap lookup tables
+    unsigned char table[4 * COLORMAP_SIZE];
+    glGenTextures(COLORMAP_COUNT, colormapTex);
+    for (int i = 0; i < COLORMAP_COUNT; i++) {
+        colormapTable(i, COLORMAP_SIZE, table);
+        glBindTexture(GL_TEXTURE_1D, colormapTex[i]);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, COLORMAP_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, table);
     }
 
-    delete [] boundaryData;
-    delete [] lbmData[0];
-    delete [] lbmData[1];
-    delete [] lbmData[2];
-    delete [] lbmData[3];
     return true;
 }
 
-void createGLObjs(Shader & renderProgram) {
+void createGLObjs(Shader & renderProgram, Shader & particleProgram) {
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
     float vertices[] = {
@@ -265,50 +460,67 @@ void createGLObjs(Shader & renderProgram) {
 
     // load and create textures
     // -------------------------
-    const char * image_path = "./mask.jpg";
-    if (!initFluidState(image_path)) {
+    if (!initFluidState(opts.maskPath.c_str())) {
         std::cout << "Error: state initialization failed!" << std::endl;
         exit(1);
     }
+    int fbW, fbH;
+    glfwGetFramebufferSize(window, &fbW, &fbH);
+    fitViewport(fbW, fbH);
 
     // set uniform variables for render.frag
     renderProgram.use();
-    glUniform1i(glGetUniformLocation(renderProgram.ID, "boundary_texture"), 0);
-    glUniform1i(glGetUniformLocation(renderProgram.ID, "state_texture3"), 1);
+    glUniform1i(glGetUniformLocation(renderProgram.ID, "display_texture"), 0);
+    glUniform1i(glGetUniformLocation(renderProgram.ID, "colormap"), 1);
+    glUniform1i(glGetUniformLocation(renderProgram.ID, "lic_texture"), 2);
+
+    // set uniform variables for particle.vert
+    particleProgram.use();
+    glUniform2f(glGetUniformLocation(particleProgram.ID, "lattice_size"), (float)latticeWidth, (float)latticeHeight);
+    glUniform1f(glGetUniformLocation(particleProgram.ID, "lifetime"), particles.lifetime);
 }
 
 void initCL() {
-    cl_int errCode;
-
     try {
         std::vector<cl::Device> vDevices;
         cl::Platform plat = getPlatform();
         plat.getDevices(CL_DEVICE_TYPE_GPU, &vDevices);
 
+        interop = false;
         for (int i = 0; i < vDevices.size(); i++) {
             if (checkExtnAvailability(vDevices[i])) {
                 device = vDevices[i];
+                interop = true;
                 break;
             }
         }
 
-        cl_context_properties cps[] = {
-            CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetWGLContext(window),
-            CL_WGL_HDC_KHR, (cl_context_properties)GetDC(glfwGetWin32Window(window)),
-            CL_CONTEXT_PLATFORM, (cl_context_properties)plat(),
-            0
-        };
-
-        context = cl::Context(device, cps);
-        queue = cl::CommandQueue(context, device);
-        program = getProgram(context, "lbm.cl", errCode);
-        program.build(std::vector<cl::Device>(1, device));
-        kernel = cl::Kernel(program, "lbm");
-        kernelReset = cl::Kernel(program, "resetFluid");
+        if (interop) {
+            cl_context_properties cps[] = {
+                CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetWGLContext(window),
+                CL_WGL_HDC_KHR, (cl_context_properties)GetDC(glfwGetWin32Window(window)),
+                CL_CONTEXT_PLATFORM, (cl_context_properties)plat(),
+                0
+            };
+            context = cl::Context(device, cps);
+        } else {
+            // the display output is read back to the host instead of shared
+            if (vDevices.empty())
+                plat.getDevices(CL_DEVICE_TYPE_ALL, &vDevices);
+            if (vDevices.empty()) {
+                std::cout << "No OpenCL device found" << std::endl;
+                exit(1);
+            }
+            std::cout << CL_GL_SHARING_EXT << " not available, displaying through host memory" << std::endl;
+            device = vDevices[0];
+            context = cl::Context(device);
+        }
+        queue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+        program = buildProgram(context, device);
+
+        copyBandwidth = measureCopyBandwidth(context, queue, program, device);
     } catch(cl::Error error) {
         std::cout << error.what() << "(" << error.err() << ")" << std::endl;
-        std::string val = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-        std::cout << "Log:\n" << val << std::endl;
         exit(1);
     }
 }
@@ -317,174 +529,401 @@ void CLReferGLTex() {
     cl_int errCode;
 
     try {
-        // boundary tex
-        lbmGLBoundary = cl::ImageGL(context, CL_MEM_READ_WRITE, GL_TEXTURE_2D, 
-                                    0, lbmBoundary, &errCode);
-        if (errCode != CL_SUCCESS) {
-            std::cout << "Failed to create OpenGL texture reference: " << errCode << std::endl;
-            exit(1);
+        if (!interop) {
+            // plain CL images of the same formats and staging for their read back
+            for (int i = 0; i < 3; i++) {
+                displayHost[i] = cl::Image2D(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT),
+                                             latticeWidth, latticeHeight);
+                licHost[i] = cl::Image2D(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_R, CL_UNORM_INT8),
+                                         latticeWidth, latticeHeight);
+                displayCL[i] = &displayHost[i];
+                licCL[i] = &licHost[i];
+            }
+            readback.init((GLADloadproc)glfwGetProcAddress, latticeWidth, latticeHeight,
+                          (size_t)particles.count * 4 * sizeof(float));
+            return;
         }
 
-        // lbm tex
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 3; j++) {
-                lbmGLBuffer[i][j] = cl::ImageGL(context, CL_MEM_READ_WRITE, GL_TEXTURE_2D, 
-                                                0, lbmBuffer[i][j], &errCode);
+        // display tex
+        for (int i = 0; i < 3; i++) {
+            displayGL[i] = cl::ImageGL(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 
+                                       0, displayTex[i], &errCode);
+            displayCL[i] = &displayGL[i];
+            if (errCode != CL_SUCCESS) {
+                std::cout << "Failed to create OpenGL texture reference: " << errCode << std::endl;
+                exit(1);
+            }
+            licGL[i] = cl::ImageGL(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, licTex[i], &errCode);
+            licCL[i] = &licGL[i];
+            if (errCode != CL_SUCCESS) {
+                std::cout << "Failed to create OpenGL texture reference: " << errCode << std::endl;
+                exit(1);
+            }
+            if (particles.count > 0) {
+                particleGL[i] = cl::BufferGL(context, CL_MEM_WRITE_ONLY, particleVBO[i], &errCode);
                 if (errCode != CL_SUCCESS) {
-                    std::cout << "Failed to create OpenGL texture reference: " << errCode << std::endl;
+                    std::cout << "Failed to create OpenGL buffer reference: " << errCode << std::endl;
                     exit(1);
                 }
             }
         }
     } catch(cl::Error error) {
         std::cout << error.what() << "(" << error.err() << ")" << std::endl;
-        std::string val = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-        std::cout << "Log:\n" << val << std::endl;
         exit(1);
     }
 }
 
-void CLCompute(int readBufferIdx, float mouse_x, float mouse_y) {
-    assert(readBufferIdx == 0 || readBufferIdx == 1);
+void CLInitFluid() {
+    // resample the mask to the lattice, derive the occupancy bitmap and tile summary
+    // and set the initial state
+    try {
+        sim.initCellTypes(queue, lbmMask, maskWidth, maskHeight, 2);
+        sim.reset(queue);
+        sim.finish(queue);
+        if (particles.count > 0) {
+            particles.seed(queue, sim);
+            particles.finish(queue);
+        }
+    } catch(cl::Error err) {
+        std::cout << err.what() << "(" << err.err() << ")" << std::endl;
+        exit(1);
+    }
+    lbmMask = cl::Image2D();
+}
 
+void CLPublishDisplay(cl::CommandQueue & simQueue, int steps, float mouseX, float mouseY, int visMode, bool lic) {
+    // advance _steps_ time steps with the visualization of the last one fused into the
+    // back display slot and hand the slot to the GL thread. The GL thread has finished
+    // reading the slot before giving it back, see consumeDisplay.
     cl::Event ev;
-    try {
-        glFinish();
-
-        std::vector<cl::Memory> objs;
-        objs.push_back(lbmGLBoundary);
-        for (int i = 0; i < 2; i++)
-            for (int j = 0; j < 3; j++)
-                objs.push_back(lbmGLBuffer[i][j]);
-        
-        // acquiring GL textures
-        cl_int res = queue.enqueueAcquireGLObjects(&objs, NULL, &ev);
+    cl_int res;
+    int slot = displaySlots.back();
+    std::vector<cl::Memory> objs(1, displayGL[slot]);
+    if (particles.count > 0)
+        objs.push_back(particleGL[slot]);
+    if (lic)
+        objs.push_back(licGL[slot]);
+
+    // acquiring GL textures
+    if (interop) {
+        res = simQueue.enqueueAcquireGLObjects(&objs, NULL, &ev);
         ev.wait();
         if (res != CL_SUCCESS) {
             std::cout << "Failed acquiring GL object: " << res << std::endl;
             exit(1);
         }
-        
-        // set kernel args
-        kernel.setArg(0, lbmGLBoundary);                        // boundary_tex
-        kernel.setArg(1, lbmGLBuffer[readBufferIdx][0]);        // src_state_tex1
-        kernel.setArg(2, lbmGLBuffer[readBufferIdx][1]);        // src_state_tex2
-        kernel.setArg(3, lbmGLBuffer[readBufferIdx][2]);        // src_state_tex3
-        kernel.setArg(4, lbmGLBuffer[1 - readBufferIdx][0]);    // dst_state_tex1
-        kernel.setArg(5, lbmGLBuffer[1 - readBufferIdx][1]);    // dst_state_tex2
-        kernel.setArg(6, lbmGLBuffer[1 - readBufferIdx][2]);    // dst_state_tex3
-        kernel.setArg(7, tau);                                  // tau
-        kernel.setArg(8, winWidth);                             // image_size_x
-        kernel.setArg(9, winHeight);                            // image_size_y
-        kernel.setArg(10, mouse_x);                             // mouse_loc_x
-        kernel.setArg(11, (float)winHeight - mouse_y);          // mouse_loc_y
-
-        cl::NDRange blockCfg(THREAD_PER_BLOCK_DIM, THREAD_PER_BLOCK_DIM);
-        cl::NDRange gridCfg(blockCfg[0] * NUM_BLOCKS(winWidth, blockCfg[0]), 
-                            blockCfg[1] * NUM_BLOCKS(winHeight, blockCfg[1]));
-
-        queue.enqueueNDRangeKernel(kernel, cl::NullRange, gridCfg, blockCfg);
+    }
+
+    sim.step(simQueue, steps, mouseX, mouseY, displayCL[slot], visMode, displayRange[slot]);
+    if (lic)
+        sim.lineIntegralConvolution(simQueue, *licCL[slot]);
+    if (particles.count > 0)
+        particles.advect(simQueue, sim, steps);
+
+    if (interop) {
+        if (particles.count > 0)
+            particles.copyTo(simQueue, particleGL[slot]);
 
         // release GL textures
-        res = queue.enqueueReleaseGLObjects(&objs, NULL, &ev);
+        res = simQueue.enqueueReleaseGLObjects(&objs, NULL, &ev);
         ev.wait();
         if (res != CL_SUCCESS) {
             std::cout << "Failed releasing GL object: " << res << std::endl;
             exit(1);
         }
-        queue.finish();
-    } catch(cl::Error err) {
-        std::cout << err.what() << "(" << err.err() << ")" << std::endl;
+    } else {
+        // only the display output crosses to the host, uploaded by the GL thread on consume
+        cl::size_t<3> origin, region;
+        origin[0] = origin[1] = origin[2] = 0;
+        region[0] = latticeWidth;
+        region[1] = latticeHeight;
+        region[2] = 1;
+        simQueue.enqueueReadImage(displayHost[slot], CL_FALSE, origin, region, 0, 0, readback.display(slot));
+        if (lic)
+            simQueue.enqueueReadImage(licHost[slot], CL_FALSE, origin, region, 0, 0, readback.lic(slot));
+        if (particles.count > 0)
+            particles.readTo(simQueue, readback.particles(slot));
     }
+    sim.finish(simQueue);
+    if (particles.count > 0)
+        particles.finish(simQueue);
+
+    displayMode[slot] = visMode;
+    displayLic[slot] = lic;
+    displaySlots.publish();
+    glfwPostEmptyEvent();   // wake up the GL thread
 }
 
-void CLResetFluid(int readBufferIdx) {
-    assert(readBufferIdx == 0 || readBufferIdx == 1);
+void simulationLoop() {
+    // runs on its own thread and queue: drains input, advances the lattice in batches
+    // and publishes the latest state at most displayHz times per second
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](Clock::duration d) { return std::chrono::duration<double>(d).count(); };
+
+    float mouseX = -1.0f, mouseY = -1.0f;
+    int visMode = VIS_VELOCITY;
+    bool lic = false;
+    int stepsPerBatch = 1;
+    double stepSeconds = 0.0;   // per step, measured on batches without display
+    Clock::time_point nextPublishTime = Clock::now();
+    Clock::time_point lastReportTime = Clock::now();
 
-    cl::Event ev;
     try {
-        glFinish();
-
-        std::vector<cl::Memory> objs;
-        for (int j = 0; j < 3; j++)
-            objs.push_back(lbmGLBuffer[readBufferIdx][j]);
-        
-        // acquiring GL textures
-        cl_int res = queue.enqueueAcquireGLObjects(&objs, NULL, &ev);
-        ev.wait();
-        if (res != CL_SUCCESS) {
-            std::cout << "Failed acquiring GL object: " << res << std::endl;
-            exit(1);
-        }
-        
-        // set kernel args
-        kernelReset.setArg(0, lbmGLBuffer[readBufferIdx][0]);        // state_tex1
-        kernelReset.setArg(1, lbmGLBuffer[readBufferIdx][1]);        // state_tex2
-        kernelReset.setArg(2, lbmGLBuffer[readBufferIdx][2]);        // state_tex3
-        kernelReset.setArg(3, rhoInit);                              // init_rho
-        kernelReset.setArg(4, winWidth);                             // image_size_x
-        kernelReset.setArg(5, winHeight);                            // image_size_y
+        cl::CommandQueue simQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+        while (simRunning.load()) {
+            InputEvent ev;
+            while (inputQueue.pop(ev)) {
+                if (ev.type == InputEvent::RESET) {
+                    sim.reset(simQueue);
+                    if (particles.count > 0)
+                        particles.seed(simQueue, sim);
+                }
+                else if (ev.type == InputEvent::VIS_MODE)
+                    visMode = ev.mode;
+                else if (ev.type == InputEvent::LIC)
+                    lic = ev.mode != 0;
+                else {
+                    mouseX = ev.x;
+                    mouseY = ev.y;
+                }
+            }
 
-        cl::NDRange blockCfg(THREAD_PER_BLOCK_DIM, THREAD_PER_BLOCK_DIM);
-        cl::NDRange gridCfg(blockCfg[0] * NUM_BLOCKS(winWidth, blockCfg[0]), 
-                            blockCfg[1] * NUM_BLOCKS(winHeight, blockCfg[1]));
+            // the display is written by the last step of a batch, not by a separate pass
+            bool publish = Clock::now() >= nextPublishTime;
+            int steps = stepsPerBatch;
+            Clock::time_point batchStart = Clock::now();
+            if (publish)
+                CLPublishDisplay(simQueue, steps, mouseX, mouseY, visMode, lic);
+            else {
+                sim.step(simQueue, steps, mouseX, mouseY);
+                if (particles.count > 0)
+                    particles.advect(simQueue, sim, steps);
+                sim.finish(simQueue);
+                if (particles.count > 0)
+                    particles.finish(simQueue);
+            }
+            stepCount += steps;
 
-        queue.enqueueNDRangeKernel(kernelReset, cl::NullRange, gridCfg, blockCfg);
+            // aim for batches of a quarter display interval so input is picked up often
+            double batchSeconds = seconds(Clock::now() - batchStart);
+            if (batchSeconds > 0.0) {
+                double scale = std::min(2.0, std::max(0.5, 0.25 / opts.displayHz / batchSeconds));
+                stepsPerBatch = std::max(1, std::min(1 << 16, (int)(stepsPerBatch * scale + 0.5)));
+            }
 
-        // release GL textures
-        res = queue.enqueueReleaseGLObjects(&objs, NULL, &ev);
-        ev.wait();
-        if (res != CL_SUCCESS) {
-            std::cout << "Failed releasing GL object: " << res << std::endl;
-            exit(1);
+            if (!publish)
+                stepSeconds = batchSeconds / steps;
+            else {
+                // the display may take at most displayBudget of the device time
+                double displaySeconds = std::max(0.0, batchSeconds - steps * stepSeconds) + renderSeconds.load();
+                double interval = std::max(1.0 / opts.displayHz, displaySeconds / opts.displayBudget);
+                nextPublishTime = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                     std::chrono::duration<double>(interval));
+            }
+
+            if (seconds(Clock::now() - lastReportTime) >= 2.0) {
+                std::vector<KernelStats *> stats = sim.stats();
+                if (particles.count > 0)
+                    for (KernelStats * s : particles.stats())
+                        stats.push_back(s);
+                reportKernelStats(stats, copyBandwidth);
+                lastReportTime = Clock::now();
+            }
         }
-        queue.finish();
+        simQueue.finish();
     } catch(cl::Error err) {
         std::cout << err.what() << "(" << err.err() << ")" << std::endl;
     }
 }
 
-void GLRenderFrame(Shader & renderProgram, int readBufferIdx) {
-    assert(readBufferIdx == 0 || readBufferIdx == 1);
+bool consumeDisplay() {
+    // picks up the latest published display slot. The slot given back to the
+    // simulation thread may still be read by queued draws, so wait for them first.
+    if (!displaySlots.hasFresh())
+        return false;
+    int slot = displaySlots.front();
+    if (displayFence[slot]) {
+        glClientWaitSync(displayFence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(displayFence[slot]);
+        displayFence[slot] = 0;
+    }
+    if (!displaySlots.consume())
+        return false;
+    slot = displaySlots.front();
+    if (!interop)
+        readback.upload(slot, displayTex[slot], licTex[slot], displayLic[slot], particles.count > 0 ? particleVBO[slot] : 0);
+    mipmapsValid[slot] = false;
+    return true;
+}
+
+void GLRenderFrame(Shader & renderProgram, Shader & particleProgram, int slot) {
+    // color scale from the range reduced on device, fixed ranges as fallback
+    int mode = displayMode[slot];
+    float lo = visRange[mode][0], hi = visRange[mode][1];
+    if (autoRange && displayRange[slot][0] <= displayRange[slot][1]) {
+        lo = displayRange[slot][0];
+        hi = displayRange[slot][1];
+        if (visModeSigned(mode)) {
+            hi = std::max(std::fabs(lo), std::fabs(hi));
+            lo = -hi;
+        }
+        if (hi - lo < 1e-9f) {
+            lo -= 1e-9f;
+            hi += 1e-9f;
+        }
+    }
+
+    // only the visible part is drawn, so the cost follows the screen pixels. When a screen
+    // pixel covers more than one cell, sample the mip level of matching size instead of
+    // scattering over the full texture; its levels are built once per new frame.
+    float rect[4];
+    viewRect(rect);
+    bool minified = latticeWidth * rect[2] > viewWidth || latticeHeight * rect[3] > viewHeight;
+    if (minified && !mipmapsValid[slot]) {
+        glBindTexture(GL_TEXTURE_2D, displayTex[slot]);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        if (displayLic[slot]) {
+            glBindTexture(GL_TEXTURE_2D, licTex[slot]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        mipmapsValid[slot] = true;
+    }
+    for (unsigned int tex : { displayTex[slot], licTex[slot] }) {
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minified ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    }
 
     glClearColor(199.0 / 255, 237.0 / 255, 204.0 / 255, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
+    glViewport(viewX, viewY, viewWidth, viewHeight);
     renderProgram.use();
+    glUniform4f(glGetUniformLocation(renderProgram.ID, "view_rect"), rect[0], rect[1], rect[2], rect[3]);
+    glUniform1f(glGetUniformLocation(renderProgram.ID, "value_min"), lo);
+    glUniform1f(glGetUniformLocation(renderProgram.ID, "value_max"), hi);
+    glUniform1i(glGetUniformLocation(renderProgram.ID, "lic_enabled"), displayLic[slot] ? 1 : 0);
     glBindVertexArray(VAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, lbmBoundary);
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, lbmBuffer[1 - readBufferIdx][2]);
+    glBindTexture(GL_TEXTURE_1D, colormapTex[visColormap[mode]]);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, licTex[slot]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, displayTex[slot]);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+    // tracer particles on top, straight from the shared vertex buffer
+    if (particles.count > 0 && showParticles) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        particleProgram.use();
+        glUniform4f(glGetUniformLocation(particleProgram.ID, "view_rect"), rect[0], rect[1], rect[2], rect[3]);
+        glBindVertexArray(particleVAO[slot]);
+        glDrawArrays(GL_POINTS, 0, particles.count);
+        glDisable(GL_BLEND);
+    }
 }
 
-int main() {
+void presentFrame(Shader & renderProgram, Shader & particleProgram) {
+    // GPU time of the previous frame, read without waiting for it
+    if (renderQueryPending) {
+        GLint available = 0;
+        glGetQueryObjectiv(renderQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(renderQuery, GL_QUERY_RESULT, &ns);
+            renderSeconds = ns * 1e-9;
+            renderQueryPending = false;
+        }
+    }
+
+    int slot = displaySlots.front();
+    bool measure = !renderQueryPending;
+    if (measure)
+        glBeginQuery(GL_TIME_ELAPSED, renderQuery);
+    GLRenderFrame(renderProgram, particleProgram, slot);
+    if (measure) {
+        glEndQuery(GL_TIME_ELAPSED);
+        renderQueryPending = true;
+    }
+
+    // the frame size of a recording is fixed, it ends when the window is resized
+    if (!opts.capturePath.empty() && !captureDone) {
+        if (!capture.active())
+            captureDone = !capture.open(opts.capturePath, viewWidth, viewHeight, opts.displayHz);
+        if (capture.active() && (viewWidth != capture.width || viewHeight != capture.height)) {
+            std::cout << "Window resized, capture stopped" << std::endl;
+            capture.close();
+            captureDone = true;
+        }
+        if (capture.active())
+            capture.readFrame(viewX, viewY, glfwGetTime());
+    }
+    if (displayFence[slot])
+        glDeleteSync(displayFence[slot]);
+    displayFence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glfwSwapBuffers(window);
+    nbFrames++;
+}
+
+int main(int argc, char ** argv) {
+    if (!parseOptions(argc, argv, opts))
+        return 1;
+    if (!opts.sweepPath.empty())
+        return runSweep(opts);
+    if (opts.headless)
+        return runHeadless(opts);
+    // frames go to stdout, keep the log out of the stream
+    if (opts.capturePath == "-")
+        std::cout.rdbuf(std::cerr.rdbuf());
+
     initGL();
     initCL();
     
     Shader renderProgram("./vertex.vert", "./render.frag");
-    createGLObjs(renderProgram);
+    Shader particleProgram("./particle.vert", "./particle.frag");
+    createGLObjs(renderProgram, particleProgram);
     CLReferGLTex();
+    CLInitFluid();
+
+    // the simulation thread uses display images only after GL is done with their setup
+    glFinish();
+    simRunning = true;
+    simThread = std::thread(simulationLoop);
 
     std::cout << "Render loop started ..." << std::endl;
-    int readBufferIdx = 0;
-    int count = 0;
+    glGenQueries(1, &renderQuery);
+    bool hasFrame = false;
     while (!glfwWindowShouldClose(window)) {
-        bool fReset = processInput(window);
-        auto [mouse_x, mouse_y] = getMouseClickPos(window);
-
+        // woken up by input or by a published frame
+        glfwWaitEventsTimeout(0.1);
+        processInput(window);
         showFPS(window);
 
-        if (fReset)
-            CLResetFluid(readBufferIdx);
-        CLCompute(readBufferIdx, (float)mouse_x, (float)mouse_y);
-        GLRenderFrame(renderProgram, readBufferIdx);
-        readBufferIdx = 1 - readBufferIdx;
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (consumeDisplay()) {
+            hasFrame = true;
+            redraw = true;
+        }
+        if (hasFrame && redraw) {
+            presentFrame(renderProgram, particleProgram);
+            redraw = false;
+        }
     }
 
+    simRunning = false;
+    simThread.join();
+
+    capture.close();
+    readback.release();
+    glDeleteQueries(1, &renderQuery);
+    for (int i = 0; i < 3; i++)
+        if (displayFence[i])
+            glDeleteSync(displayFence[i]);
+    glDeleteTextures(3, displayTex);
+    glDeleteTextures(3, licTex);
+    glDeleteTextures(COLORMAP_COUNT, colormapTex);
+    glDeleteVertexArrays(3, particleVAO);
+    glDeleteBuffers(3, particleVBO);
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
@@ -0,0 +1,330 @@
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "cell_type.h"
+#include "geometry.h"
+#include "mask.h"
+
+#define MASK_STRIP_BYTES (16 << 20)     // cell types classified and written to the device at once
+#define MASK_THREAD_ROWS 64             // fewest rows worth a thread of their own
+#define MASK_HEADER_BYTES 4096          // read for the size of a mask
+
+namespace {
+
+// Pixels of a mask image, top row first as stored in image files
+struct MaskPixels {
+    const unsigned char * data = NULL;
+    size_t rowBytes = 0;
+    int width = 0, height = 0;
+    int channels = 1;
+    int bitDepth = 8;                   // 1 (PBM, set bits are black), 8 or 16 (big-endian)
+    int maxValue = 255;
+};
+
+// Header of a binary PBM, PGM or PPM file of which _size_ bytes are at _p_
+bool parsePnmHeader(const unsigned char * p, size_t size, MaskPixels & pixels, size_t & dataOffset)
+{
+    if (size < 2 || p[0] != 'P' || (p[1] != '4' && p[1] != '5' && p[1] != '6'))
+        return false;
+    bool bitmap = p[1] == '4';
+    long fields[3] = { 0, 0, 0 };
+    size_t i = 2;
+    for (int f = 0; f < (bitmap ? 2 : 3); f++) {
+        // whitespace, and comments up to the end of their line
+        while (i < size && (isspace(p[i]) || p[i] == '#')) {
+            if (p[i] == '#')
+                while (i < size && p[i] != '\n')
+                    i++;
+            else
+                i++;
+        }
+        if (i >= size || !isdigit(p[i]))
+            return false;
+        while (i < size && isdigit(p[i]) && fields[f] < (1L << 30))
+            fields[f] = fields[f] * 10 + (p[i++] - '0');
+    }
+    // a single whitespace character ends the header
+    if (bitmap)
+        fields[2] = 1;
+    if (i >= size || !isspace(p[i]) || fields[0] <= 0 || fields[1] <= 0 || fields[2] <= 0 || fields[2] > 65535)
+        return false;
+
+    dataOffset = i + 1;
+    pixels.width = (int)fields[0];
+    pixels.height = (int)fields[1];
+    pixels.channels = p[1] == '6' ? 3 : 1;
+    pixels.maxValue = (int)fields[2];
+    pixels.bitDepth = bitmap ? 1 : pixels.maxValue > 255 ? 16 : 8;
+    pixels.rowBytes = bitmap ? (pixels.width + 7) / 8 : (size_t)pixels.width * pixels.channels * pixels.bitDepth / 8;
+    return true;
+}
+
+// A whole file mapped read-only into memory
+class MappedFile
+{
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (base)
+            munmap((void *)base, length);
+#endif
+    }
+
+    bool open(const char * path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            return false;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping)
+            return false;
+        base = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        length = (size_t)fileSize.QuadPart;
+#else
+        int fd = ::open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        length = (size_t)st.st_size;
+        void * p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        madvise(p, length, MADV_SEQUENTIAL);
+        base = (const unsigned char *)p;
+#endif
+        return base != NULL;
+    }
+
+    const unsigned char * data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char * base = NULL;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#endif
+};
+
+// The pixels of a mask: mapped for PNM files, so that only the rows being classified
+// are resident, else decoded whole by stb_image
+class MaskSource
+{
+public:
+    MaskPixels pixels;
+
+    ~MaskSource()
+    {
+        if (decoded)
+            stbi_image_free(decoded);
+    }
+
+    bool open(const char * path)
+    {
+        size_t offset;
+        if (file.open(path) && parsePnmHeader(file.data(), file.size(), pixels, offset)) {
+            if (file.size() - offset < pixels.rowBytes * pixels.height)
+                return false;
+            pixels.data = file.data() + offset;
+            return true;
+        }
+
+        // rows are flipped while classifying, stb keeps the file order
+        stbi_set_flip_vertically_on_load(false);
+        decoded = stbi_load(path, &pixels.width, &pixels.height, &pixels.channels, 0);
+        if (decoded == NULL)
+            return false;
+        pixels.data = decoded;
+        pixels.bitDepth = 8;
+        pixels.maxValue = 255;
+        pixels.rowBytes = (size_t)pixels.width * pixels.channels;
+        return true;
+    }
+
+private:
+    MappedFile file;
+    unsigned char * decoded = NULL;
+};
+
+// classify lattice rows [rowBegin, rowBegin + rows), counted bottom-up, into _dst_
+void classifyRows(const MaskPixels & px, int rowBegin, int rows, unsigned char * dst)
+{
+    int bytes = px.bitDepth / 8;
+    for (int r = 0; r < rows; r++) {
+        const unsigned char * src = px.data + (size_t)(px.height - 1 - rowBegin - r) * px.rowBytes;
+        unsigned char * out = dst + (size_t)r * px.width;
+        for (int x = 0; x < px.width; x++) {
+            unsigned char rgb[3];
+            if (px.bitDepth == 1) {
+                rgb[0] = rgb[1] = rgb[2] = (src[x >> 3] >> (7 - (x & 7))) & 1 ? 0 : 255;
+            } else {
+                for (int c = 0; c < 3; c++) {
+                    const unsigned char * s = src + ((size_t)x * px.channels + (px.channels >= 3 ? c : 0)) * bytes;
+                    int v = bytes == 2 ? (s[0] << 8) | s[1] : s[0];
+                    rgb[c] = (unsigned char)(px.maxValue == 255 ? v : std::min(255, v * 255 / px.maxValue));
+                }
+            }
+            out[x] = classifyMaskPixel(rgb[0], rgb[1], rgb[2]);
+        }
+    }
+}
+
+// classifyRows split into strips over the cores
+void classifyRowsParallel(const MaskPixels & px, int rowBegin, int rows, unsigned char * dst)
+{
+    int threads = std::max(1, std::min((int)std::thread::hardware_concurrency(), rows / MASK_THREAD_ROWS));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        int begin = (int)((long long)rows * t / threads), end = (int)((long long)rows * (t + 1) / threads);
+        workers.emplace_back(classifyRows, std::cref(px), rowBegin + begin, end - begin, dst + (size_t)begin * px.width);
+    }
+    classifyRows(px, rowBegin, (int)((long long)rows / threads), dst);
+    for (std::thread & w : workers)
+        w.join();
+}
+
+}
+
+bool loadMask(const char * imagePath, std::vector<unsigned char> & cellTypes, int & maskWidth, int & maskHeight)
+{
+    MaskSource source;
+    if (!source.open(imagePath)) {
+        std::cout << "Unable to load mask " << imagePath << std::endl;
+        return false;
+    }
+    maskWidth = source.pixels.width;
+    maskHeight = source.pixels.height;
+    std::cout << "texture image (HxW):" << maskHeight << " x " << maskWidth << std::endl;
+
+    // Classify every pixel of the mask, the lattice margin is added when resampling
+    cellTypes.resize((size_t)maskWidth * maskHeight);
+    classifyRowsParallel(source.pixels, 0, maskHeight, cellTypes.data());
+    return true;
+}
+
+bool maskSize(const char * imagePath, int & maskWidth, int & maskHeight)
+{
+    if (isGeometryPath(imagePath)) {
+        Geometry geometry;
+        if (!loadGeometry(imagePath, geometry))
+            return false;
+        maskWidth = geometry.width;
+        maskHeight = geometry.height;
+        return true;
+    }
+
+    std::ifstream file(imagePath, std::ios::binary);
+    unsigned char header[MASK_HEADER_BYTES];
+    file.read((char *)header, sizeof(header));
+    MaskPixels pixels;
+    size_t offset;
+    int channels;
+    if (parsePnmHeader(header, (size_t)file.gcount(), pixels, offset)) {
+        maskWidth = pixels.width;
+        maskHeight = pixels.height;
+    } else if (!stbi_info(imagePath, &maskWidth, &maskHeight, &channels)) {
+        std::cout << "Unable to load mask " << imagePath << std::endl;
+        return false;
+    }
+    std::cout << "texture image (HxW):" << maskHeight << " x " << maskWidth << std::endl;
+    return true;
+}
+
+bool loadMaskImage(cl::Context & pContext, cl::CommandQueue & pQueue, const char * imagePath, cl::Image2D & mask,
+                   int & maskWidth, int & maskHeight)
+{
+    MaskSource source;
+    if (!source.open(imagePath)) {
+        std::cout << "Unable to load mask " << imagePath << std::endl;
+        return false;
+    }
+    maskWidth = source.pixels.width;
+    maskHeight = source.pixels.height;
+    mask = cl::Image2D(pContext, CL_MEM_READ_ONLY, cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), maskWidth, maskHeight);
+
+    // two strips in turn: one is classified while the other is written to the device
+    int stripRows = std::max(1, std::min(maskHeight, MASK_STRIP_BYTES / maskWidth));
+    std::vector<unsigned char> strips[2];
+    cl::Event written[2];
+    bool writing[2] = { false, false };
+    for (int row = 0, s = 0; row < maskHeight; row += stripRows, s = 1 - s) {
+        int rows = std::min(stripRows, maskHeight - row);
+        if (writing[s])
+            written[s].wait();
+        strips[s].resize((size_t)rows * maskWidth);
+        classifyRowsParallel(source.pixels, row, rows, strips[s].data());
+
+        cl::size_t<3> origin, region;
+        origin[0] = 0; origin[1] = row; origin[2] = 0;
+        region[0] = maskWidth; region[1] = rows; region[2] = 1;
+        pQueue.enqueueWriteImage(mask, CL_FALSE, origin, region, 0, 0, strips[s].data(), NULL, &written[s]);
+        pQueue.flush();
+        writing[s] = true;
+    }
+    pQueue.finish();
+    return true;
+}
+
+bool loadLatticeMask(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram, const char * path,
+                     int width, int height, cl::Image2D & mask, int & maskWidth, int & maskHeight,
+                     cl::Image2D * distance)
+{
+    if (distance)
+        *distance = cl::Image2D();
+    if (!isGeometryPath(path))
+        return loadMaskImage(pContext, pQueue, path, mask, maskWidth, maskHeight);
+
+    // maskSize has reported the geometry already
+    Geometry geometry;
+    if (!loadGeometry(path, geometry, false))
+        return false;
+    rasterizeGeometry(pContext, pQueue, pProgram, geometry, width, height, mask, distance);
+    maskWidth = width;
+    maskHeight = height;
+    return true;
+}
+
+void latticeSize(const Options & opts, int maskWidth, int maskHeight, int & width, int & height)
+{
+    // lattice resolution is independent of the mask, which is resampled on device
+    width = opts.latticeWidth;
+    height = opts.latticeHeight;
+    if (width == 0 || height == 0) {
+        width = std::max(1, (int)(maskWidth * opts.latticeScale));
+        height = std::max(1, (int)(maskHeight * opts.latticeScale));
+    }
+    std::cout << "lattice (HxW):" << height << " x " << width << std::endl;
+}
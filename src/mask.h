@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "options.h"
+
+// Masks are read from binary PBM (P4), PGM (P5) and PPM (P6) files through a memory
+// mapping, or decoded whole by stb_image for other formats. Pixels are classified into
+// cell types in strips of rows on all cores.
+
+// Load a mask image and classify every pixel into a CellType (see classifyMaskPixel),
+// rows bottom-up as the lattice. Returns false if the image cannot be read.
+bool loadMask(const char * imagePath, std::vector<unsigned char> & cellTypes, int & maskWidth, int & maskHeight);
+
+// Read the size of a mask image from its header only, or the reference size of a geometry
+// file (see geometry.h). Returns false if it cannot be read.
+bool maskSize(const char * imagePath, int & maskWidth, int & maskHeight);
+
+// As loadMask, into a new device image of cell types (CL_R, CL_UNSIGNED_INT8) written in
+// strips as they are classified, so that the host holds a few strips, not the whole map
+bool loadMaskImage(cl::Context & pContext, cl::CommandQueue & pQueue, const char * imagePath, cl::Image2D & mask,
+                   int & maskWidth, int & maskHeight);
+
+// The cell types of a width x height lattice from a mask image or a geometry file: images
+// as loadMaskImage, geometries evaluated at the lattice resolution, so that resampling
+// _mask_ is one to one. _distance_, if given, receives the wall distance of a geometry
+// (see rasterizeGeometry) and is left empty for images.
+bool loadLatticeMask(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram, const char * path,
+                     int width, int height, cl::Image2D & mask, int & maskWidth, int & maskHeight,
+                     cl::Image2D * distance = NULL);
+
+// Lattice resolution for a mask: the --lattice size, else the mask scaled by --lattice-scale
+void latticeSize(const Options & opts, int maskWidth, int maskHeight, int & width, int & height);
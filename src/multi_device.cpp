@@ -0,0 +1,174 @@
+#include <iostream>
+#include <string>
+
+#include "multi_device.h"
+
+MultiDeviceSimulation::MultiDeviceSimulation(cl::Context & pContext, cl::Program & pProgram, std::vector<cl::Device> & pDevices,
+                                             int pWidth, int pHeight)
+    : width(pWidth), height(pHeight), context(pContext)
+{
+    int n = (int)pDevices.size();
+    slabs.resize(n);
+    for (int i = 0; i < n; i++) {
+        Slab & slab = slabs[i];
+        slab.originY = (int)((long long)height * i / n);
+        slab.rows = (int)((long long)height * (i + 1) / n) - slab.originY;
+        slab.sim = Simulation(context, pProgram, width, slab.rows + 2);
+        slab.sim.rangeRowBegin = 1;
+        slab.sim.rangeRowEnd = slab.rows + 1;
+        slab.sim.edgeRow[0] = 1;
+        slab.sim.edgeRow[1] = slab.rows;
+        slab.queue = cl::CommandQueue(context, pDevices[i], CL_QUEUE_PROFILING_ENABLE);
+        slab.copyQueue = cl::CommandQueue(context, pDevices[i]);
+        slab.vis = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, slab.rows + 2);
+        slab.edgeRows = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, 6);
+
+        std::string suffix = " [" + std::to_string(i) + "]";
+        for (KernelStats * s : slab.sim.stats())
+            s->name += suffix;
+        std::string deviceName = pDevices[i].getInfo<CL_DEVICE_NAME>();
+        std::cout << "slab " << i << ": rows " << slab.originY << " - " << slab.originY + slab.rows - 1
+                  << " on " << deviceName << std::endl;
+    }
+
+    slabRanges = cl::Buffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_float2));
+    visRangeBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float2));
+    kernelRange = cl::Kernel(pProgram, "reduceRange");
+    kernelRange.setArg(0, slabRanges);                      // partial_range
+    kernelRange.setArg(1, n);                               // n
+    kernelRange.setArg(2, visRangeBuffer);                  // vis_range
+    rangeStats.bytesPerCell = n * sizeof(cl_float2) / ((double)width * height);
+}
+
+void MultiDeviceSimulation::initCellTypes(cl::Image2D & mask, int maskWidth, int maskHeight, int margin)
+{
+    // the halo rows take the cell types of the neighbouring rows of the lattice
+    for (Slab & slab : slabs)
+        slab.sim.initCellTypes(slab.queue, mask, maskWidth, maskHeight, margin, slab.originY - 1, height);
+}
+
+void MultiDeviceSimulation::reset()
+{
+    // halo rows start from the same equilibrium as the rows they mirror
+    for (Slab & slab : slabs)
+        slab.sim.reset(slab.queue);
+    edgesValid = false;
+}
+
+void MultiDeviceSimulation::pullHalos(int i)
+{
+    int n = (int)slabs.size();
+    Slab & slab = slabs[i];
+    Slab & above = slabs[(i + n - 1) % n];
+    Slab & below = slabs[(i + 1) % n];
+
+    // the own copy is waited for too, the coming step overwrites the rows it reads
+    std::vector<cl::Event> waitList = { above.edgesCopied, below.edgesCopied, slab.edgesCopied };
+
+    cl::size_t<3> region, lastOfAbove, firstOfBelow, topHalo, bottomHalo;
+    region[0] = width; region[1] = 1; region[2] = 1;
+    lastOfAbove[0] = 0; lastOfAbove[2] = 0;
+    firstOfBelow[0] = 0; firstOfBelow[2] = 0;
+    topHalo[0] = 0; topHalo[1] = 0; topHalo[2] = 0;
+    bottomHalo[0] = 0; bottomHalo[1] = slab.rows + 1; bottomHalo[2] = 0;
+
+    // the three state texels of the first own row in edge rows 0-2, of the last in 3-5
+    for (int j = 0; j < 3; j++) {
+        cl::Event evAbove, evBelow;
+        lastOfAbove[1] = 3 + j;
+        firstOfBelow[1] = j;
+        slab.queue.enqueueCopyImage(above.edgeRows, slab.sim.state[slab.sim.readIdx][j],
+                                    lastOfAbove, topHalo, region, &waitList, &evAbove);
+        slab.queue.enqueueCopyImage(below.edgeRows, slab.sim.state[slab.sim.readIdx][j],
+                                    firstOfBelow, bottomHalo, region, &waitList, &evBelow);
+        above.edgesRead.push_back(evAbove);
+        below.edgesRead.push_back(evBelow);
+    }
+}
+
+void MultiDeviceSimulation::copyEdges(int i, cl::Event & edgesDone)
+{
+    Slab & slab = slabs[i];
+
+    // once the edge bands are done and the neighbours have pulled the previous rows
+    std::vector<cl::Event> waitList = slab.edgesRead;
+    waitList.push_back(edgesDone);
+    slab.edgesRead.clear();
+
+    cl::size_t<3> origin, region;
+    origin[0] = 0; origin[1] = 0; origin[2] = 0;
+    region[0] = width; region[1] = 6; region[2] = 1;
+
+    // from the copy the edge bands left in sim.edgeState, the interior band still writes the
+    // state images; the next step rewrites it only after pullHalos() waited for this copy
+    slab.copyQueue.enqueueCopyImage(slab.sim.edgeState, slab.edgeRows, origin, origin, region, &waitList, &slab.edgesCopied);
+    slab.copyQueue.flush();
+}
+
+void MultiDeviceSimulation::step(int steps, cl::Image * vis, int visMode)
+{
+    int n = (int)slabs.size();
+
+    // every slab pulls its halos and issues its edge bands before any copies the new
+    // edges out, so that the copies of a step only wait for the pulls of the previous one
+    for (int s = 0; s < steps; s++) {
+        bool fused = vis && s == steps - 1;
+        std::vector<cl::Event> edgesDone(n);
+        for (int i = 0; i < n; i++) {
+            if (edgesValid)
+                pullHalos(i);
+            slabs[i].sim.stepEdgesFirst(slabs[i].queue, 2, NULL, edgesDone[i], fused ? &slabs[i].vis : NULL, visMode);
+        }
+        for (int i = 0; i < n; i++)
+            copyEdges(i, edgesDone[i]);
+        edgesValid = true;
+    }
+
+    if (vis && steps > 0) {
+        // gather the slab rows of the visualization and the slab ranges on the first device,
+        // which alone writes the gathered images
+        std::vector<cl::Event> slabDone(n);
+        for (int i = 0; i < n; i++) {
+            slabs[i].queue.enqueueMarkerWithWaitList(NULL, &slabDone[i]);
+            slabs[i].queue.flush();
+        }
+        for (int i = 0; i < n; i++) {
+            Slab & slab = slabs[i];
+            cl::size_t<3> srcOrigin, dstOrigin, region;
+            srcOrigin[0] = 0; srcOrigin[1] = 1; srcOrigin[2] = 0;
+            dstOrigin[0] = 0; dstOrigin[1] = slab.originY; dstOrigin[2] = 0;
+            region[0] = width; region[1] = slab.rows; region[2] = 1;
+
+            std::vector<cl::Event> waitSlab(1, slabDone[i]);
+            queue().enqueueCopyImage(slab.vis, *vis, srcOrigin, dstOrigin, region, &waitSlab);
+            queue().enqueueCopyBuffer(slab.sim.visRangeDevice(), slabRanges, 0, i * sizeof(cl_float2),
+                                      sizeof(cl_float2), &waitSlab);
+        }
+
+        cl::Event evKernel;
+        cl::NDRange reduceCfg(THREAD_PER_BLOCK_DIM * THREAD_PER_BLOCK_DIM);
+        queue().enqueueNDRangeKernel(kernelRange, cl::NullRange, reduceCfg, reduceCfg, NULL, &evKernel);
+        pending.push_back({ &rangeStats, evKernel });
+    }
+}
+
+void MultiDeviceSimulation::finish()
+{
+    for (Slab & slab : slabs) {
+        slab.copyQueue.finish();
+        slab.sim.finish(slab.queue);
+    }
+    for (auto & launch : pending)
+        recordKernel(*launch.first, launch.second, (double)width * height);
+    pending.clear();
+}
+
+std::vector<KernelStats *> MultiDeviceSimulation::stats()
+{
+    std::vector<KernelStats *> all;
+    for (Slab & slab : slabs)
+        for (KernelStats * s : slab.sim.stats())
+            all.push_back(s);
+    all.push_back(&rangeStats);
+    return all;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "perf_util.h"
+#include "simulation.h"
+
+// One lattice split into horizontal slabs over the devices of a shared context.
+// Each slab is a Simulation of its rows plus one halo row above and below, wrapping
+// in y like the single-device lattice. A step first updates the edge bands of every
+// slab, whose first and last rows a second queue copies into small exchange images
+// while the interior band is computed; the next step pulls the rows of the
+// neighbours from there into its halo rows. Every image is written by one device
+// only, and the order comes from events, so the host never waits between steps.
+class MultiDeviceSimulation
+{
+public:
+    int width = 0, height = 0;
+    KernelStats rangeStats{"reduceRange (slabs)"};
+
+    MultiDeviceSimulation(cl::Context & pContext, cl::Program & pProgram, std::vector<cl::Device> & pDevices,
+                          int pWidth, int pHeight);
+
+    // as Simulation::initCellTypes for the whole lattice, using the first queue
+    void initCellTypes(cl::Image2D & mask, int maskWidth, int maskHeight, int margin);
+    void reset();
+    // advance _steps_ time steps. With _vis_ given (width x height), the last step writes
+    // the visualization into it and its range into visRangeDevice(); both are ready for
+    // work enqueued on queue() afterwards.
+    void step(int steps, cl::Image * vis = NULL, int visMode = VIS_VELOCITY);
+    void finish();
+
+    cl::CommandQueue & queue() { return slabs[0].queue; }
+    cl::Buffer & visRangeDevice() { return visRangeBuffer; }
+    std::vector<KernelStats *> stats();
+
+private:
+    struct Slab {
+        Simulation sim;                 // rows + 2 high, the halo rows are 0 and rows + 1
+        cl::CommandQueue queue, copyQueue;
+        int originY = 0, rows = 0;      // lattice rows held in sim rows 1 .. rows
+        cl::Image2D vis;
+        cl::Image2D edgeRows;           // sim.edgeState of the latest step, first and last own row
+        cl::Event edgesCopied;          // edgeRows hold the latest step
+        std::vector<cl::Event> edgesRead; // neighbours pulling from edgeRows
+    };
+
+    cl::Context context;
+    std::vector<Slab> slabs;
+    bool edgesValid = false;            // edgeRows hold a step, not the reset state
+    cl::Kernel kernelRange;
+    cl::Buffer slabRanges, visRangeBuffer;  // (min, max) of every slab and of the lattice
+    std::vector<std::pair<KernelStats *, cl::Event>> pending;
+
+    void pullHalos(int i);
+    void copyEdges(int i, cl::Event & edgesDone);
+};
@@ -0,0 +1,123 @@
+#include <iostream>
+#include "colormap.h"
+#include "image_io.h"
+#include "offscreen.h"
+
+#define COLORMAP_SIZE 256
+
+OffscreenRenderer::OffscreenRenderer(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram,
+                                     int pWidth, int pHeight, int colormap, const std::string & pFormat,
+                                     std::shared_ptr<DevicePoolLease> pLease)
+    : width(pWidth), height(pHeight), format(pFormat), mapQueue(pQueue), lease(pLease)
+{
+    size_t imageBytes = (size_t)width * height * 4;
+
+    if (!lease)
+        lease = std::make_shared<DevicePoolLease>(pContext, (DevicePool *)NULL);
+    vis = lease->image2D(CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    rgba = lease->buffer(CL_MEM_READ_WRITE, imageBytes);
+
+    std::vector<unsigned char> table(4 * COLORMAP_SIZE);
+    colormapTable(colormap, COLORMAP_SIZE, table.data());
+    colormapBuffer = cl::Buffer(pContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, table.size(), table.data());
+
+    // pinned host memory, so the read back is a DMA transfer without an extra copy
+    for (int i = 0; i < OFFSCREEN_STAGING_COUNT; i++) {
+        staging[i] = cl::Buffer(pContext, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, imageBytes);
+        stagingPtr[i] = (unsigned char *)pQueue.enqueueMapBuffer(staging[i], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, imageBytes);
+        freeStaging.push_back(i);
+    }
+
+    kernelColorize = cl::Kernel(pProgram, "colorize");
+    colorizeStats.bytesPerCell = imageElementSize(vis) + 4;
+
+    running = true;
+    encoder = std::thread(&OffscreenRenderer::encoderLoop, this);
+}
+
+void OffscreenRenderer::write(cl::CommandQueue & pQueue, cl::Buffer & visRange, int visMode, const std::string & path)
+{
+    int slot;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !freeStaging.empty(); });
+        slot = freeStaging.back();
+        freeStaging.pop_back();
+    }
+
+    kernelColorize.setArg(0, vis);                          // vis_tex
+    kernelColorize.setArg(1, visRange);                     // vis_range
+    kernelColorize.setArg(2, colormapBuffer);               // colormap
+    kernelColorize.setArg(3, COLORMAP_SIZE);                // colormap_size
+    kernelColorize.setArg(4, visModeSigned(visMode) ? 1 : 0); // symmetric
+    kernelColorize.setArg(5, rgba);                         // rgba
+    kernelColorize.setArg(6, width);                        // image_size_x
+    kernelColorize.setArg(7, height);                       // image_size_y
+
+    cl::Event evKernel, evRead;
+    cl::NDRange blockCfg(THREAD_PER_BLOCK_DIM, THREAD_PER_BLOCK_DIM);
+    cl::NDRange gridCfg(THREAD_PER_BLOCK_DIM * NUM_BLOCKS(width, THREAD_PER_BLOCK_DIM),
+                        THREAD_PER_BLOCK_DIM * NUM_BLOCKS(height, THREAD_PER_BLOCK_DIM));
+    pQueue.enqueueNDRangeKernel(kernelColorize, cl::NullRange, gridCfg, blockCfg, NULL, &evKernel);
+    pending.push_back({ &colorizeStats, evKernel });
+    pQueue.enqueueReadBuffer(rgba, CL_FALSE, 0, (size_t)width * height * 4, stagingPtr[slot], NULL, &evRead);
+    pQueue.flush();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({ slot, evRead, path });
+    }
+    changed.notify_all();
+}
+
+void OffscreenRenderer::finish(cl::CommandQueue & pQueue)
+{
+    pQueue.finish();
+    for (auto & launch : pending)
+        recordKernel(*launch.first, launch.second, (double)width * height);
+    pending.clear();
+}
+
+void OffscreenRenderer::close()
+{
+    if (!running)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    encoder.join();
+    running = false;
+
+    for (int i = 0; i < OFFSCREEN_STAGING_COUNT; i++)
+        mapQueue.enqueueUnmapMemObject(staging[i], stagingPtr[i]);
+    mapQueue.finish();
+}
+
+void OffscreenRenderer::encoderLoop()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        job.ready.wait();
+        bool ok = format == "ppm" ? writePPM(job.path, stagingPtr[job.staging], width, height)
+                                  : writePNG(job.path, stagingPtr[job.staging], width, height);
+        if (!ok)
+            std::cout << "Unable to write " << job.path << std::endl;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeStaging.push_back(job.staging);
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "device_pool.h"
+#include "perf_util.h"
+#include "simulation.h"
+
+#define OFFSCREEN_STAGING_COUNT 3   // images being read back or encoded at once
+
+// Images of the flow without GL: the colorize kernel maps the visualization output
+// of the lbm step to RGBA8, which is read back into pinned staging buffers that an
+// encoder thread writes to PNG or PPM files. The simulation thread only waits when
+// every staging buffer is still being encoded.
+class OffscreenRenderer
+{
+public:
+    cl::Image2D vis;                    // pass to Simulation::step as the visualization output
+    KernelStats colorizeStats{"colorize"};
+
+    // _vis_ and the RGBA8 output are taken through _lease_ if given, the mapped staging
+    // buffers never are
+    OffscreenRenderer(cl::Context & pContext, cl::CommandQueue & pQueue, cl::Program & pProgram,
+                      int pWidth, int pHeight, int colormap, const std::string & pFormat,
+                      std::shared_ptr<DevicePoolLease> pLease = NULL);
+    ~OffscreenRenderer() { close(); }
+
+    // colormap _vis_ over the (min, max) in _visRange_, as left by the step of a
+    // simulation in its visRangeDevice(), and write it to _path_
+    void write(cl::CommandQueue & pQueue, cl::Buffer & visRange, int visMode, const std::string & path);
+    void finish(cl::CommandQueue & pQueue);
+    // wait for the queued images to be written and stop the encoder
+    void close();
+
+private:
+    struct Job {
+        int staging;
+        cl::Event ready;                // read into the staging buffer done
+        std::string path;
+    };
+
+    int width = 0, height = 0;
+    std::string format;
+    cl::CommandQueue mapQueue;
+    cl::Kernel kernelColorize;
+    cl::Buffer colormapBuffer, rgba;
+    std::shared_ptr<DevicePoolLease> lease;
+    cl::Buffer staging[OFFSCREEN_STAGING_COUNT];  // CL_MEM_ALLOC_HOST_PTR, mapped for their lifetime
+    unsigned char * stagingPtr[OFFSCREEN_STAGING_COUNT];
+    std::vector<std::pair<KernelStats *, cl::Event>> pending;
+
+    std::thread encoder;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Job> jobs;
+    std::vector<int> freeStaging;
+    bool stopping = false, running = false;
+
+    void encoderLoop();
+};
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include "options.h"
+
+static void printUsage(const char * prog)
+{
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "  --mask <path>          boundary mask image or .geo geometry (default ./mask.jpg)\n"
+              << "  --lattice <W>x<H>      lattice resolution, the mask is resampled to it\n"
+              << "  --lattice-scale <s>    lattice resolution relative to the mask (default 1)\n"
+              << "  --window <W>x<H>       initial window size (default 800x600)\n"
+              << "  --display-hz <f>       maximum display rate (default 30)\n"
+              << "  --display-budget <f>   maximum fraction of device time spent drawing (default 0.1)\n"
+              << "  --particles <n>        tracer particles, 0 disables them (default 131072)\n"
+              << "  --capture <path>       record the drawn frames to a .y4m or raw RGB24 file, - for stdout\n"
+              << "  --headless             run without a window and write images of the flow\n"
+              << "  --steps <n>            time steps of a headless run (default 10000)\n"
+              << "  --output-every <n>     steps between images of a headless run (default 1000)\n"
+              << "  --output <prefix>      image file prefix, <prefix>_<step>.<format> (default frame)\n"
+              << "  --output-format <f>    png or ppm (default png)\n"
+              << "  --vis <quantity>       velocity, vorticity, pressure or qcriterion (default velocity)\n"
+              << "  --colormap <name>      viridis, coolwarm, grayscale or blue\n"
+              << "  --devices <n>          split a headless run into slabs over n GPUs (default 1)\n"
+              << "  --cpu-subdevices <n>   split a headless run over n sub-devices of the CPU instead\n"
+              << "  --transport <t>        run a headless slab per process, exchanging halos through shm or mpi\n"
+              << "  --rank <r> --ranks <n> rank of this process and number of processes (shm transport)\n"
+              << "  --shm-name <name>      shared memory segment of the shm transport (default lbmcl_halo)\n"
+              << "  --out-of-core          keep a headless lattice in host memory and stream it through the device\n"
+              << "  --chunk-rows <n>       lattice rows per streamed chunk (default 1024)\n"
+              << "  --block-steps <n>      steps per chunk upload, also its halo depth (default 8)\n"
+              << "  --ensemble <file>      run the members listed in file (tau ux uy [mask] per line) in one lattice\n"
+              << "  --sweep <file>         run every combination of the parameter grid in file on all devices\n"
+              << "  --plan                 print the memory a headless run needs and whether it fits, then exit\n"
+              << "  --auto-fit             shrink the lattice (or the out-of-core chunks) to what fits the device\n";
+}
+
+static bool parseSize(const char * str, int & width, int & height)
+{
+    return sscanf(str, "%dx%d", &width, &height) == 2 && width > 0 && height > 0;
+}
+
+bool parseOptions(int argc, char ** argv, Options & opts)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+
+        if (arg == "--mask" && hasValue) {
+            opts.maskPath = argv[++i];
+        } else if (arg == "--lattice" && hasValue) {
+            ok = parseSize(argv[++i], opts.latticeWidth, opts.latticeHeight);
+        } else if (arg == "--lattice-scale" && hasValue) {
+            opts.latticeScale = (float)atof(argv[++i]);
+            ok = opts.latticeScale > 0.0f;
+        } else if (arg == "--window" && hasValue) {
+            ok = parseSize(argv[++i], opts.windowWidth, opts.windowHeight);
+        } else if (arg == "--display-hz" && hasValue) {
+            opts.displayHz = (float)atof(argv[++i]);
+            ok = opts.displayHz > 0.0f;
+        } else if (arg == "--display-budget" && hasValue) {
+            opts.displayBudget = (float)atof(argv[++i]);
+            ok = opts.displayBudget > 0.0f && opts.displayBudget <= 1.0f;
+        } else if (arg == "--particles" && hasValue) {
+            opts.particles = atoi(argv[++i]);
+            ok = opts.particles >= 0;
+        } else if (arg == "--capture" && hasValue) {
+            opts.capturePath = argv[++i];
+        } else if (arg == "--headless") {
+            opts.headless = true;
+        } else if (arg == "--steps" && hasValue) {
+            opts.steps = atoll(argv[++i]);
+            ok = opts.steps > 0;
+        } else if (arg == "--output-every" && hasValue) {
+            opts.outputEvery = atoi(argv[++i]);
+            ok = opts.outputEvery > 0;
+        } else if (arg == "--output" && hasValue) {
+            opts.outputPrefix = argv[++i];
+        } else if (arg == "--output-format" && hasValue) {
+            opts.outputFormat = argv[++i];
+            ok = opts.outputFormat == "png" || opts.outputFormat == "ppm";
+        } else if (arg == "--vis" && hasValue) {
+            opts.visName = argv[++i];
+        } else if (arg == "--colormap" && hasValue) {
+            opts.colormapName = argv[++i];
+        } else if (arg == "--devices" && hasValue) {
+            opts.devices = atoi(argv[++i]);
+            ok = opts.devices > 0;
+        } else if (arg == "--cpu-subdevices" && hasValue) {
+            opts.cpuSubdevices = atoi(argv[++i]);
+            ok = opts.cpuSubdevices > 0;
+        } else if (arg == "--transport" && hasValue) {
+            opts.transport = argv[++i];
+            ok = opts.transport == "shm" || opts.transport == "mpi";
+        } else if (arg == "--rank" && hasValue) {
+            opts.rank = atoi(argv[++i]);
+            ok = opts.rank >= 0;
+        } else if (arg == "--ranks" && hasValue) {
+            opts.ranks = atoi(argv[++i]);
+            ok = opts.ranks > 0;
+        } else if (arg == "--shm-name" && hasValue) {
+            opts.shmName = argv[++i];
+        } else if (arg == "--ensemble" && hasValue) {
+            opts.ensemblePath = argv[++i];
+        } else if (arg == "--sweep" && hasValue) {
+            opts.sweepPath = argv[++i];
+            opts.headless = true;
+        } else if (arg == "--plan") {
+            opts.plan = true;
+            opts.headless = true;
+        } else if (arg == "--auto-fit") {
+            opts.autoFit = true;
+        } else if (arg == "--out-of-core") {
+            opts.outOfCore = true;
+        } else if (arg == "--chunk-rows" && hasValue) {
+            opts.chunkRows = atoi(argv[++i]);
+            ok = opts.chunkRows > 0;
+        } else if (arg == "--block-steps" && hasValue) {
+            opts.blockSteps = atoi(argv[++i]);
+            ok = opts.blockSteps > 0;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cout << "Invalid argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (opts.rank >= opts.ranks) {
+        std::cout << "Invalid argument: --rank " << opts.rank << " of " << opts.ranks << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+// Run configuration parsed from the command line
+struct Options {
+    std::string maskPath = "./mask.jpg";
+    int latticeWidth = 0, latticeHeight = 0;    // 0: use the mask resolution
+    float latticeScale = 1.0f;                  // applied to the mask resolution if no size is given
+    int windowWidth = 800, windowHeight = 600;
+    float displayHz = 30.0f;                    // maximum display rate
+    float displayBudget = 0.1f;                 // maximum fraction of device time spent drawing
+    int particles = 131072;                     // tracer particles, 0 disables them
+    std::string capturePath;                    // .y4m or raw RGB24 recording, "-" for stdout
+
+    // headless runs: no window, images of the flow written every outputEvery steps
+    bool headless = false;
+    long long steps = 10000;                    // total time steps of a headless run
+    int outputEvery = 1000;
+    std::string outputPrefix = "frame";         // images are <prefix>_<step>.<format>
+    std::string outputFormat = "png";           // png or ppm
+    std::string visName = "velocity";           // velocity, vorticity, pressure or qcriterion
+    std::string colormapName;                   // empty: the default of the quantity
+    int devices = 1;                            // GPUs the lattice is split over
+    int cpuSubdevices = 0;                      // >0: split over sub-devices of the CPU instead
+
+    // distributed headless runs: one slab per process
+    std::string transport;                      // shm or mpi, empty: a single process
+    int rank = 0, ranks = 1;                    // given by MPI for the mpi transport
+    std::string shmName = "lbmcl_halo";
+
+    // out-of-core headless runs: the lattice lives in host memory
+    bool outOfCore = false;
+    int chunkRows = 1024;                       // rows streamed through the device at once
+    int blockSteps = 8;                         // steps per upload, also the halo depth
+
+    std::string ensemblePath;                   // members of an ensemble run, one per line
+    std::string sweepPath;                      // parameter grid of a sweep over all devices
+
+    // memory planning before anything is allocated
+    bool plan = false;                          // print the footprint of a headless run and exit
+    bool autoFit = false;                       // shrink a run that does not fit the device
+};
+
+// Returns false (after printing usage) on malformed arguments
+bool parseOptions(int argc, char ** argv, Options & opts);
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "colormap.h"
+#include "image_io.h"
+#include "out_of_core.h"
+
+#define COLORMAP_SIZE 256
+
+OutOfCoreSimulation::OutOfCoreSimulation(cl::Context & pContext, cl::Program & pProgram, cl::Device & pDevice,
+                                         int pWidth, int pHeight, int pChunkRows, int pBlockSteps)
+    : width(pWidth), height(pHeight), chunkRows(std::min(pChunkRows, pHeight)), blockSteps(pBlockSteps)
+{
+    uploadQueue = cl::CommandQueue(pContext, pDevice);
+    computeQueue = cl::CommandQueue(pContext, pDevice, CL_QUEUE_PROFILING_ENABLE);
+    downloadQueue = cl::CommandQueue(pContext, pDevice);
+
+    slots.resize(std::min(OUT_OF_CORE_SLOTS, chunkCount()));
+    for (Slot & slot : slots) {
+        slot.sim = Simulation(pContext, pProgram, width, sliceRows());
+        slot.vis = cl::Image2D(pContext, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, sliceRows());
+    }
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++)
+            host[i][j].resize((size_t)width * height * 4);
+    chunks.resize(chunkCount());
+    chunkRange.resize(chunkCount());
+
+    std::cout << "out of core: " << chunkCount() << " chunks of " << chunkRows << " rows, "
+              << deviceBytes() / (1024 * 1024) << " MB on the device" << std::endl;
+}
+
+size_t OutOfCoreSimulation::deviceBytes() const
+{
+    // state, visualization and cell type texels plus the occupancy bitmap
+    size_t cells = (size_t)width * sliceRows();
+    return slots.size() * cells * (7 * 4 * sizeof(float) + 1 + sizeof(cl_uint) / 32.0);
+}
+
+void OutOfCoreSimulation::initCellTypes(cl::Image2D & mask, int maskWidth, int maskHeight, int margin)
+{
+    // every chunk is resampled once in the first slot and its cell types kept on the host,
+    // then each slot is set up once more so that its kernels refer to its own buffers
+    Simulation & sim = slots[0].sim;
+    size_t tiles = (size_t)sim.occupancy.tilesX * sim.occupancy.tilesY;
+    cl::size_t<3> origin, region;
+    origin[0] = 0; origin[1] = 0; origin[2] = 0;
+    region[0] = width; region[1] = sliceRows(); region[2] = 1;
+
+    for (int c = 0; c < chunkCount(); c++) {
+        ChunkCells & cells = chunks[c];
+        cells.cellType.resize((size_t)width * sliceRows());
+        cells.tileType.resize(tiles);
+        cells.occupancyBits.resize((size_t)sim.occupancy.pitch * sliceRows());
+
+        sim.initCellTypes(computeQueue, mask, maskWidth, maskHeight, margin, c * chunkRows - blockSteps, height);
+        computeQueue.enqueueReadImage(sim.cellType, CL_FALSE, origin, region, 0, 0, cells.cellType.data());
+        computeQueue.enqueueReadBuffer(sim.tileType, CL_FALSE, 0, tiles, cells.tileType.data());
+        computeQueue.enqueueReadBuffer(sim.occupancyBits, CL_TRUE, 0, cells.occupancyBits.size() * sizeof(cl_uint),
+                                       cells.occupancyBits.data());
+    }
+    for (size_t s = 1; s < slots.size(); s++)
+        slots[s].sim.initCellTypes(computeQueue, mask, maskWidth, maskHeight, margin, -blockSteps, height);
+    computeQueue.finish();
+}
+
+void OutOfCoreSimulation::reset()
+{
+    // equilibrium everywhere, written by the device one chunk at a time
+    Simulation & sim = slots[0].sim;
+    for (int c = 0; c < chunkCount(); c++) {
+        int rows = std::min(chunkRows, height - c * chunkRows);
+        sim.reset(computeQueue);
+        for (int j = 0; j < 3; j++)
+            transferRows(computeQueue, false, sim.state[sim.readIdx][j], blockSteps, host[readHost][j].data(), c * chunkRows, rows);
+        computeQueue.finish();
+    }
+    // solid tiles never come back from the device, both host copies keep them at equilibrium,
+    // and the other slots start from finite state in the tiles their uploads leave alone
+    for (int j = 0; j < 3; j++)
+        host[1 - readHost][j] = host[readHost][j];
+    for (size_t s = 1; s < slots.size(); s++)
+        slots[s].sim.reset(computeQueue);
+    for (Slot & slot : slots)
+        slot.sim.finish(computeQueue);
+}
+
+void OutOfCoreSimulation::downloadWrittenRows(Simulation & sim, const ChunkCells & cells, int firstRow, int rows)
+{
+    // lbm never writes solid tiles, there the slot holds the state of another chunk: only the
+    // runs of other tiles come back, in one transfer for tile rows without solid tiles
+    int tilesX = sim.occupancy.tilesX;
+    auto solidFree = [&](int ty) {
+        const unsigned char * t = &cells.tileType[(size_t)ty * tilesX];
+        return std::find(t, t + tilesX, (unsigned char)TILE_SOLID) == t + tilesX;
+    };
+    size_t rowPitch = (size_t)width * 4 * sizeof(float);
+    for (int y = blockSteps; y < blockSteps + rows;) {
+        int ty = y / THREAD_PER_BLOCK_DIM;
+        int yEnd = std::min(blockSteps + rows, (ty + 1) * THREAD_PER_BLOCK_DIM);
+        bool full = solidFree(ty);
+        while (full && yEnd < blockSteps + rows && solidFree(yEnd / THREAD_PER_BLOCK_DIM))
+            yEnd = std::min(blockSteps + rows, yEnd + THREAD_PER_BLOCK_DIM);
+
+        const unsigned char * tiles = &cells.tileType[(size_t)ty * tilesX];
+        for (int tx = 0; tx < tilesX;) {
+            if (!full && tiles[tx] == TILE_SOLID) {
+                tx++;
+                continue;
+            }
+            int txEnd = full ? tilesX : tx;
+            while (txEnd < tilesX && tiles[txEnd] != TILE_SOLID)
+                txEnd++;
+            int x0 = tx * THREAD_PER_BLOCK_DIM, x1 = std::min(width, txEnd * THREAD_PER_BLOCK_DIM);
+            cl::size_t<3> origin, region;
+            origin[0] = x0; origin[1] = y; origin[2] = 0;
+            region[0] = x1 - x0; region[1] = yEnd - y; region[2] = 1;
+            size_t offset = ((size_t)(firstRow + y - blockSteps) * width + x0) * 4;
+            for (int j = 0; j < 3; j++)
+                downloadQueue.enqueueReadImage(sim.state[sim.readIdx][j], CL_FALSE, origin, region, rowPitch, 0,
+                                               host[1 - readHost][j].data() + offset);
+            tx = txEnd;
+        }
+        y = yEnd;
+    }
+}
+
+void OutOfCoreSimulation::transferRows(cl::CommandQueue & pQueue, bool upload, cl::Image2D & image, int imageRow,
+                                       float * hostData, int latticeRow, int rows)
+{
+    // rows wrap around the lattice, which takes two transfers at the top or bottom
+    while (rows > 0) {
+        int row = ((latticeRow % height) + height) % height;
+        int count = std::min(rows, height - row);
+        cl::size_t<3> origin, region;
+        origin[0] = 0; origin[1] = imageRow; origin[2] = 0;
+        region[0] = width; region[1] = count; region[2] = 1;
+        float * data = hostData + (size_t)row * width * 4;
+        if (upload)
+            pQueue.enqueueWriteImage(image, CL_FALSE, origin, region, 0, 0, data);
+        else
+            pQueue.enqueueReadImage(image, CL_FALSE, origin, region, 0, 0, data);
+        imageRow += count;
+        latticeRow += count;
+        rows -= count;
+    }
+}
+
+void OutOfCoreSimulation::runChunk(int chunk, int slotIdx, int steps, bool vis, int visMode)
+{
+    Slot & slot = slots[slotIdx];
+    Simulation & sim = slot.sim;
+    ChunkCells & cells = chunks[chunk];
+    int firstRow = chunk * chunkRows;
+    int rows = std::min(chunkRows, height - firstRow);
+
+    // upload once the previous chunk of the slot is back
+    std::vector<cl::Event> waitSlot;
+    if (slot.busy)
+        waitSlot.push_back(slot.downloaded);
+    uploadQueue.enqueueMarkerWithWaitList(&waitSlot);
+    cl::size_t<3> origin, region;
+    origin[0] = 0; origin[1] = 0; origin[2] = 0;
+    region[0] = width; region[1] = sliceRows(); region[2] = 1;
+    uploadQueue.enqueueWriteImage(sim.cellType, CL_FALSE, origin, region, 0, 0, cells.cellType.data());
+    uploadQueue.enqueueWriteBuffer(sim.tileType, CL_FALSE, 0, cells.tileType.size(), cells.tileType.data());
+    uploadQueue.enqueueWriteBuffer(sim.occupancyBits, CL_FALSE, 0, cells.occupancyBits.size() * sizeof(cl_uint),
+                                   cells.occupancyBits.data());
+    for (int j = 0; j < 3; j++)
+        transferRows(uploadQueue, true, sim.state[sim.readIdx][j], 0, host[readHost][j].data(), firstRow - blockSteps, sliceRows());
+    std::vector<cl::Event> uploaded(1);
+    uploadQueue.enqueueMarkerWithWaitList(NULL, &uploaded[0]);
+    uploadQueue.flush();
+
+    // rows further than _steps_ from the slice edges stay exact
+    computeQueue.enqueueMarkerWithWaitList(&uploaded);
+    sim.rangeRowBegin = blockSteps;
+    sim.rangeRowEnd = blockSteps + rows;
+    sim.step(computeQueue, steps, -1.0f, -1.0f, vis ? &slot.vis : NULL, visMode);
+    std::vector<cl::Event> computed(1);
+    computeQueue.enqueueMarkerWithWaitList(NULL, &computed[0]);
+    computeQueue.flush();
+
+    downloadQueue.enqueueMarkerWithWaitList(&computed);
+    downloadWrittenRows(sim, cells, firstRow, rows);
+    if (vis) {
+        transferRows(downloadQueue, false, slot.vis, blockSteps, hostVis.data(), firstRow, rows);
+        downloadQueue.enqueueReadBuffer(sim.visRangeDevice(), CL_FALSE, 0, sizeof(cl_float2), &chunkRange[chunk]);
+    }
+    downloadQueue.enqueueMarkerWithWaitList(NULL, &slot.downloaded);
+    downloadQueue.flush();
+    slot.busy = true;
+}
+
+void OutOfCoreSimulation::step(int steps, bool vis, int visMode)
+{
+    if (vis && hostVis.empty())
+        hostVis.resize((size_t)width * height * 4);
+
+    while (steps > 0) {
+        int passSteps = std::min(steps, blockSteps);
+        steps -= passSteps;
+        bool passVis = vis && steps == 0;
+        for (int c = 0; c < chunkCount(); c++)
+            runChunk(c, c % (int)slots.size(), passSteps, passVis, visMode);
+
+        // the next pass reads what this one wrote
+        downloadQueue.finish();
+        for (Slot & slot : slots) {
+            slot.sim.finish(computeQueue);
+            slot.busy = false;
+        }
+        readHost = 1 - readHost;
+    }
+    if (vis)
+        lastVisMode = visMode;
+}
+
+bool OutOfCoreSimulation::writeImage(const std::string & path, int colormap, const std::string & format)
+{
+    if (hostVis.empty())
+        return false;
+
+    float lo = INFINITY, hi = -INFINITY;
+    for (const cl_float2 & r : chunkRange) {
+        lo = std::min(lo, r.s[0]);
+        hi = std::max(hi, r.s[1]);
+    }
+    if (visModeSigned(lastVisMode)) {
+        hi = std::max(std::fabs(lo), std::fabs(hi));
+        lo = -hi;
+    }
+
+    // as the colorize kernel, on the host since the lattice need not fit the device
+    unsigned char table[4 * COLORMAP_SIZE];
+    colormapTable(colormap, COLORMAP_SIZE, table);
+    std::vector<unsigned char> rgba((size_t)width * height * 4);
+    for (int y = 0; y < height; y++) {
+        const float * src = &hostVis[(size_t)y * width * 4];
+        unsigned char * dst = &rgba[(size_t)(height - 1 - y) * width * 4];
+        for (int x = 0; x < width; x++, src += 4, dst += 4) {
+            dst[0] = dst[1] = dst[2] = 0;
+            dst[3] = 255;
+            if (src[1] > 0.5f) {
+                float t = std::min(1.0f, std::max(0.0f, (src[0] - lo) / std::max(hi - lo, 1e-9f)));
+                float tx = t * (COLORMAP_SIZE - 1);
+                int i = std::min((int)tx, COLORMAP_SIZE - 2);
+                float a = tx - i;
+                for (int c = 0; c < 3; c++)
+                    dst[c] = (unsigned char)std::lrint(table[4 * i + c] * (1.0f - a) + table[4 * (i + 1) + c] * a);
+            }
+        }
+    }
+    return format == "ppm" ? writePPM(path, rgba.data(), width, height) : writePNG(path, rgba.data(), width, height);
+}
+
+std::vector<KernelStats *> OutOfCoreSimulation::stats()
+{
+    std::vector<KernelStats *> all;
+    for (Slot & slot : slots)
+        for (KernelStats * s : slot.sim.stats())
+            all.push_back(s);
+    return all;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "perf_util.h"
+#include "simulation.h"
+
+#define OUT_OF_CORE_SLOTS 3     // chunks on the device at once: uploading, computing, downloading
+
+// A lattice kept in host memory and streamed through the device in chunks of rows.
+// Each chunk goes up with _blockSteps_ halo rows on either side, advances up to that
+// many steps (temporal blocking: the halo shrinks by a row per step) and its own rows
+// come back. Chunks rotate through OUT_OF_CORE_SLOTS device slots on separate upload,
+// compute and download queues, so transfers overlap the computation of other chunks.
+// The host holds the state twice, read and written in alternating passes.
+class OutOfCoreSimulation
+{
+public:
+    int width = 0, height = 0;
+    int chunkRows = 0, blockSteps = 0;
+
+    OutOfCoreSimulation(cl::Context & pContext, cl::Program & pProgram, cl::Device & pDevice,
+                        int pWidth, int pHeight, int pChunkRows, int pBlockSteps);
+
+    // resample the mask for every chunk and keep the cell types on the host
+    void initCellTypes(cl::Image2D & mask, int maskWidth, int maskHeight, int margin);
+    void reset();
+    // advance _steps_ time steps in passes of at most blockSteps. With _vis_ set, the last
+    // pass also brings back the _visMode_ quantity for writeImage().
+    void step(int steps, bool vis = false, int visMode = VIS_VELOCITY);
+    // colormap the quantity of the last step with _vis_ over its range and write a PNG or PPM
+    bool writeImage(const std::string & path, int colormap, const std::string & format);
+
+    size_t deviceBytes() const;
+    std::vector<KernelStats *> stats();
+
+private:
+    struct Slot {
+        Simulation sim;                 // chunkRows + 2 * blockSteps high
+        cl::Image2D vis;
+        cl::Event downloaded;           // the previous chunk in this slot is back on the host
+        bool busy = false;
+    };
+    struct ChunkCells {                 // cell types of a chunk and its halo
+        std::vector<unsigned char> cellType, tileType;
+        std::vector<cl_uint> occupancyBits;
+    };
+
+    cl::CommandQueue uploadQueue, computeQueue, downloadQueue;
+    std::vector<Slot> slots;
+    std::vector<ChunkCells> chunks;
+    std::vector<float> host[2][3];      // full lattice state, RGBA float rows
+    int readHost = 0;
+    std::vector<float> hostVis;         // RGBA float quantity of the last step with vis
+    std::vector<cl_float2> chunkRange;
+    int lastVisMode = VIS_VELOCITY;
+
+    int chunkCount() const { return (height + chunkRows - 1) / chunkRows; }
+    int sliceRows() const { return chunkRows + 2 * blockSteps; }
+    void transferRows(cl::CommandQueue & pQueue, bool upload, cl::Image2D & image, int imageRow,
+                      float * hostData, int latticeRow, int rows);
+    // read the chunk's own _rows_ of the latest state of _sim_ into the host copy being written,
+    // except for solid tiles
+    void downloadWrittenRows(Simulation & sim, const ChunkCells & cells, int firstRow, int rows);
+    void runChunk(int chunk, int slot, int steps, bool vis, int visMode);
+};
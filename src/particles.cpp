@@ -0,0 +1,85 @@
+#include "particles.h"
+
+#define PARTICLE_BLOCK_SIZE 256
+
+Particles::Particles(cl::Context & pContext, cl::Program & pProgram, int pCount)
+    : count(pCount), context(pContext), program(pProgram)
+{
+    for (int i = 0; i < 2; i++)
+        particles[i] = cl::Buffer(context, CL_MEM_READ_WRITE, (size_t)count * sizeof(cl_float4));
+    liveCount = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+    kernelAdvect = cl::Kernel(program, "advectParticles");
+    kernelRespawn = cl::Kernel(program, "respawnParticles");
+
+    // read and write of a particle, the velocity samples mostly hit the cache
+    advectStats.bytesPerCell = 2 * sizeof(cl_float4);
+    respawnStats.bytesPerCell = sizeof(cl_uint);
+}
+
+void Particles::respawn(cl::CommandQueue & pQueue, Simulation & sim, bool randomAge)
+{
+    kernelRespawn.setArg(0, particles[readIdx]);            // particles
+    kernelRespawn.setArg(1, liveCount);                     // live_count
+    kernelRespawn.setArg(2, sim.cellType);                  // cell_type_tex
+    kernelRespawn.setArg(3, count);                         // n
+    kernelRespawn.setArg(4, (cl_uint)frame++);              // seed
+    kernelRespawn.setArg(5, lifetime);                      // lifetime
+    kernelRespawn.setArg(6, randomAge ? 1 : 0);             // random_age
+    kernelRespawn.setArg(7, sim.width);                     // image_size_x
+    kernelRespawn.setArg(8, sim.height);                    // image_size_y
+
+    cl::Event evKernel;
+    cl::NDRange gridCfg(PARTICLE_BLOCK_SIZE * ((count + PARTICLE_BLOCK_SIZE - 1) / PARTICLE_BLOCK_SIZE));
+    pQueue.enqueueNDRangeKernel(kernelRespawn, cl::NullRange, gridCfg, cl::NDRange(PARTICLE_BLOCK_SIZE), NULL, &evKernel);
+    pending.push_back({ &respawnStats, evKernel });
+}
+
+void Particles::seed(cl::CommandQueue & pQueue, Simulation & sim)
+{
+    pQueue.enqueueFillBuffer(liveCount, (cl_uint)0, 0, sizeof(cl_uint));
+    respawn(pQueue, sim, true);
+}
+
+void Particles::advect(cl::CommandQueue & pQueue, Simulation & sim, int steps)
+{
+    pQueue.enqueueFillBuffer(liveCount, (cl_uint)0, 0, sizeof(cl_uint));
+
+    kernelAdvect.setArg(0, particles[readIdx]);             // src_particles
+    kernelAdvect.setArg(1, particles[1 - readIdx]);         // dst_particles
+    kernelAdvect.setArg(2, liveCount);                      // live_count
+    kernelAdvect.setArg(3, sim.cellType);                   // cell_type_tex
+    kernelAdvect.setArg(4, sim.state[sim.readIdx][2]);      // state_tex3
+    kernelAdvect.setArg(5, count);                          // n
+    kernelAdvect.setArg(6, steps);                          // steps
+    kernelAdvect.setArg(7, lifetime);                       // lifetime
+    kernelAdvect.setArg(8, sim.width);                      // image_size_x
+    kernelAdvect.setArg(9, sim.height);                     // image_size_y
+
+    cl::Event evKernel;
+    cl::NDRange gridCfg(PARTICLE_BLOCK_SIZE * ((count + PARTICLE_BLOCK_SIZE - 1) / PARTICLE_BLOCK_SIZE));
+    pQueue.enqueueNDRangeKernel(kernelAdvect, cl::NullRange, gridCfg, cl::NDRange(PARTICLE_BLOCK_SIZE), NULL, &evKernel);
+    pending.push_back({ &advectStats, evKernel });
+    readIdx = 1 - readIdx;
+
+    // the live count stays on device, respawn fills the slots behind it
+    respawn(pQueue, sim, false);
+}
+
+void Particles::copyTo(cl::CommandQueue & pQueue, cl::Buffer & dst)
+{
+    pQueue.enqueueCopyBuffer(particles[readIdx], dst, 0, 0, (size_t)count * sizeof(cl_float4));
+}
+
+void Particles::readTo(cl::CommandQueue & pQueue, void * dst)
+{
+    pQueue.enqueueReadBuffer(particles[readIdx], CL_FALSE, 0, (size_t)count * sizeof(cl_float4), dst);
+}
+
+void Particles::finish(cl::CommandQueue & pQueue)
+{
+    pQueue.finish();
+    for (auto & launch : pending)
+        recordKernel(*launch.first, launch.second, (double)count);
+    pending.clear();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "perf_util.h"
+#include "simulation.h"
+
+// Passive tracer particles advected through the lattice velocity on device.
+// Particles are float4 (x, y, age, 0) in lattice units; particles that leave the
+// domain, hit a solid cell or exceed _lifetime_ steps are dropped by compaction
+// and respawned at random non-solid cells, without host involvement.
+class Particles
+{
+public:
+    int count = 0;
+    float lifetime = 4000.0f;           // steps before a particle is respawned
+
+    KernelStats advectStats{"advectParticles"}, respawnStats{"respawnParticles"};
+
+    Particles() {}
+    Particles(cl::Context & pContext, cl::Program & pProgram, int pCount);
+
+    // spawn all particles in the non-solid cells of _sim_
+    void seed(cl::CommandQueue & pQueue, Simulation & sim);
+    // move the particles by _steps_ time steps of the latest velocity of _sim_
+    void advect(cl::CommandQueue & pQueue, Simulation & sim, int steps);
+    // copy the current particles to _dst_, e.g. a shared vertex buffer
+    void copyTo(cl::CommandQueue & pQueue, cl::Buffer & dst);
+    // read the current particles to host memory, complete after finish()
+    void readTo(cl::CommandQueue & pQueue, void * dst);
+    void finish(cl::CommandQueue & pQueue);
+
+    std::vector<KernelStats *> stats() { return { &advectStats, &respawnStats }; }
+
+private:
+    cl::Context context;
+    cl::Program program;
+    cl::Kernel kernelAdvect, kernelRespawn;
+    cl::Buffer particles[2], liveCount; // compaction ping-pongs between the buffers
+    int readIdx = 0;
+    unsigned int frame = 0;             // respawn seed
+    std::vector<std::pair<KernelStats *, cl::Event>> pending;
+
+    void respawn(cl::CommandQueue & pQueue, Simulation & sim, bool randomAge);
+};
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include "perf_util.h"
+
+#define COPY_REPEATS 10
+
+size_t imageElementSize(const cl::Image & image)
+{
+    return image.getImageInfo<CL_IMAGE_ELEMENT_SIZE>();
+}
+
+double measureCopyBandwidth(cl::Context & pContext, cl::CommandQueue & pQueue,
+                            cl::Program & pProgram, cl::Device & pDevice)
+{
+    double best = 0.0;
+    try {
+        // large enough to defeat caches, small enough for any device
+        size_t maxAlloc = pDevice.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+        size_t bytes = std::min<size_t>(maxAlloc / 2, 256 << 20);
+        size_t n = bytes / (4 * sizeof(float));
+        bytes = n * 4 * sizeof(float);
+
+        cl::Buffer src(pContext, CL_MEM_READ_ONLY, bytes);
+        cl::Buffer dst(pContext, CL_MEM_WRITE_ONLY, bytes);
+        cl::Kernel kernelCopy(pProgram, "streamCopy");
+        kernelCopy.setArg(0, src);
+        kernelCopy.setArg(1, dst);
+        kernelCopy.setArg(2, (int)n);
+
+        // first launch is a warm-up and is not timed
+        for (int i = 0; i <= COPY_REPEATS; i++) {
+            cl::Event ev;
+            pQueue.enqueueNDRangeKernel(kernelCopy, cl::NullRange, cl::NDRange(n), cl::NullRange, NULL, &ev);
+            ev.wait();
+            cl_ulong start = ev.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            cl_ulong end = ev.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+            if (i > 0 && end > start)
+                best = std::max(best, 2.0 * bytes / ((end - start) * 1e-9)); // read + write
+        }
+    } catch(cl::Error err) {
+        std::cout << err.what() << "(" << err.err() << ")" << std::endl;
+    }
+    std::cout << "Device copy bandwidth: " << best * 1e-9 << " GB/s" << std::endl;
+    return best;
+}
+
+void recordKernel(KernelStats & stats, const cl::Event & ev, double cells)
+{
+    cl_ulong start = ev.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    cl_ulong end = ev.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    stats.seconds += (end - start) * 1e-9;
+    stats.cells += cells;
+    stats.launches++;
+}
+
+void reportKernelStats(std::vector<KernelStats *> & stats, double peakBandwidth)
+{
+    for (KernelStats * s : stats) {
+        if (s->launches == 0 || s->seconds <= 0.0)
+            continue;
+        double mlups = s->cells / s->seconds * 1e-6;
+        double bandwidth = s->cells * s->bytesPerCell / s->seconds;
+        std::cout << std::setw(12) << s->name << ": "
+                  << std::fixed << std::setprecision(1)
+                  << mlups << " MLUPS, "
+                  << s->bytesPerCell << " B/cell, "
+                  << bandwidth * 1e-9 << " GB/s";
+        if (peakBandwidth > 0.0)
+            std::cout << " (" << 100.0 * bandwidth / peakBandwidth << "% of copy peak)";
+        std::cout << std::defaultfloat << std::endl;
+
+        s->seconds = 0.0;
+        s->cells = 0.0;
+        s->launches = 0;
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+// Accumulated timing of one kernel variant, used for bandwidth/roofline reporting
+struct KernelStats {
+    std::string name;
+    double bytesPerCell = 0.0;  // compulsory DRAM traffic per cell update
+    double seconds = 0.0;       // accumulated device time since last report
+    double cells = 0.0;         // accumulated cell updates since last report
+    int launches = 0;
+};
+
+// Bytes per texel of an image, as stored on the device
+size_t imageElementSize(const cl::Image & image);
+
+// Measure device copy bandwidth (bytes/s) with a STREAM-like copy kernel
+double measureCopyBandwidth(cl::Context & pContext, cl::CommandQueue & pQueue,
+                            cl::Program & pProgram, cl::Device & pDevice);
+
+// Add the duration of a profiled kernel launch covering _cells_ lattice cells
+void recordKernel(KernelStats & stats, const cl::Event & ev, double cells);
+
+// Print achieved MLUPS, GB/s and fraction of the copy peak, then clear the counters
+void reportKernelStats(std::vector<KernelStats *> & stats, double peakBandwidth);
@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include "cl_util.h"
+#include "geometry.h"
+#include "simulation.h"
+
+cl::Program buildProgram(cl::Context & pContext, cl::Device & pDevice)
+{
+    std::vector<cl::Device> devices(1, pDevice);
+    return buildProgram(pContext, devices);
+}
+
+cl::Program buildProgram(cl::Context & pContext, std::vector<cl::Device> & pDevices)
+{
+    cl_int errCode;
+    cl::Program program = getProgram(pContext, "lbm.cl", errCode);
+    std::string options = cellTypeDefines() + geometryDefines() + " -DTILE_DIM=" + std::to_string(THREAD_PER_BLOCK_DIM) +
+        " -DVIS_VELOCITY=" + std::to_string(VIS_VELOCITY) + " -DVIS_VORTICITY=" + std::to_string(VIS_VORTICITY) +
+        " -DVIS_PRESSURE=" + std::to_string(VIS_PRESSURE) + " -DVIS_QCRITERION=" + std::to_string(VIS_QCRITERION) +
+        " -DLIC_LENGTH=" + std::to_string(LIC_LENGTH);
+    try {
+        program.build(pDevices, options.c_str());
+    } catch(cl::Error err) {
+        std::cout << err.what() << "(" << err.err() << ")" << std::endl;
+        for (cl::Device & device : pDevices)
+            std::cout << "Log:\n" << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+        throw;
+    }
+    return program;
+}
+
+Simulation::Simulation(cl::Context & pContext, cl::Program & pProgram, int pWidth, int pHeight,
+                       std::shared_ptr<DevicePoolLease> pLease)
+    : width(pWidth), height(pHeight), context(pContext), program(pProgram), lease(pLease)
+{
+    // without a lease, one without a pool hands out new objects
+    if (!lease)
+        lease = std::make_shared<DevicePoolLease>(context, (DevicePool *)NULL);
+
+    blockCfg = cl::NDRange(THREAD_PER_BLOCK_DIM, THREAD_PER_BLOCK_DIM);
+    gridCfg = cl::NDRange(THREAD_PER_BLOCK_DIM * NUM_BLOCKS(width, THREAD_PER_BLOCK_DIM),
+                          THREAD_PER_BLOCK_DIM * NUM_BLOCKS(height, THREAD_PER_BLOCK_DIM));
+
+    cellType = lease->image2D(CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), width, height);
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 3; j++)
+            state[i][j] = lease->image2D(CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    edgeState = lease->image2D(CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, 6);
+
+    occupancy.pitch = NUM_BLOCKS(width, 32);
+    occupancy.tilesX = NUM_BLOCKS(width, THREAD_PER_BLOCK_DIM);
+    occupancy.tilesY = NUM_BLOCKS(height, THREAD_PER_BLOCK_DIM);
+    tileType = lease->buffer(CL_MEM_READ_WRITE, (size_t)occupancy.tilesX * occupancy.tilesY);
+    occupancyBits = lease->buffer(CL_MEM_READ_WRITE, (size_t)occupancy.pitch * height * sizeof(cl_uint));
+    visPartialRange = lease->buffer(CL_MEM_READ_WRITE, (size_t)occupancy.tilesX * occupancy.tilesY * sizeof(cl_float2));
+    visRangeBuffer = lease->buffer(CL_MEM_READ_WRITE, sizeof(cl_float2));
+    nonFiniteBuffer = lease->buffer(CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+    kernel = cl::Kernel(program, "lbm");
+    kernelVis = cl::Kernel(program, "lbmVis");
+    kernelRange = cl::Kernel(program, "reduceRange");
+    kernelLic = cl::Kernel(program, "lineIntegralConvolution");
+    kernelReset = cl::Kernel(program, "resetFluid");
+}
+
+void Simulation::initCellTypes(cl::CommandQueue & pQueue, cl::Image2D & mask, int maskWidth, int maskHeight, int margin,
+                               int originY, int latticeHeight)
+{
+    resampleCellTypes(pQueue, mask, maskWidth, maskHeight, margin, originY, latticeHeight > 0 ? latticeHeight : height,
+                      0, height);
+    summarizeCellTypes(pQueue);
+}
+
+void Simulation::resampleCellTypes(cl::CommandQueue & pQueue, cl::Image2D & mask, int maskWidth, int maskHeight, int margin,
+                                   int originY, int latticeHeight, int rowBegin, int rows)
+{
+    cl::Kernel kernelResample(program, "resampleMask");
+    kernelResample.setArg(0, mask);                         // mask_tex
+    kernelResample.setArg(1, cellType);                     // cell_type_tex
+    kernelResample.setArg(2, maskWidth);                    // mask_size_x
+    kernelResample.setArg(3, maskHeight);                   // mask_size_y
+    kernelResample.setArg(4, width);                        // image_size_x
+    kernelResample.setArg(5, rowBegin + rows);              // image_size_y
+    kernelResample.setArg(6, margin);                       // margin
+    kernelResample.setArg(7, originY - rowBegin);           // origin_y
+    kernelResample.setArg(8, latticeHeight);                // lattice_size_y
+
+    cl::NDRange offset(0, rowBegin);
+    cl::NDRange rowsCfg(gridCfg[0], blockCfg[1] * NUM_BLOCKS(rows, blockCfg[1]));
+    pQueue.enqueueNDRangeKernel(kernelResample, offset, rowsCfg, blockCfg);
+}
+
+void Simulation::summarizeCellTypes(cl::CommandQueue & pQueue)
+{
+    cl::Kernel kernelOccupancy(program, "buildOccupancy");
+    kernelOccupancy.setArg(0, cellType);                    // cell_type_tex
+    kernelOccupancy.setArg(1, occupancyBits);               // occupancy
+    kernelOccupancy.setArg(2, occupancy.pitch);             // occupancy_pitch
+    kernelOccupancy.setArg(3, width);                       // image_size_x
+    kernelOccupancy.setArg(4, height);                      // image_size_y
+
+    cl::NDRange wordCfg(blockCfg[0] * NUM_BLOCKS(occupancy.pitch, blockCfg[0]), gridCfg[1]);
+    pQueue.enqueueNDRangeKernel(kernelOccupancy, cl::NullRange, wordCfg, blockCfg);
+
+    cl_int tileCount[3] = { 0, 0, 0 };
+    cl::Buffer tileCountBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(tileCount), tileCount);
+    cl::Kernel kernelTiles(program, "summarizeTiles");
+    kernelTiles.setArg(0, cellType);                        // cell_type_tex
+    kernelTiles.setArg(1, tileType);                        // tile_type
+    kernelTiles.setArg(2, tileCountBuffer);                 // tile_count
+    kernelTiles.setArg(3, occupancy.tilesX);                // tiles_x
+    kernelTiles.setArg(4, occupancy.tilesY);                // tiles_y
+    kernelTiles.setArg(5, width);                           // image_size_x
+    kernelTiles.setArg(6, height);                          // image_size_y
+
+    cl::NDRange tileCfg(blockCfg[0] * NUM_BLOCKS(occupancy.tilesX, blockCfg[0]),
+                        blockCfg[1] * NUM_BLOCKS(occupancy.tilesY, blockCfg[1]));
+    pQueue.enqueueNDRangeKernel(kernelTiles, cl::NullRange, tileCfg, blockCfg);
+    pQueue.enqueueReadBuffer(tileCountBuffer, CL_TRUE, 0, sizeof(tileCount), tileCount);
+    for (int i = 0; i < 3; i++)
+        occupancy.tileCount[i] = tileCount[i];
+
+    std::cout << "tiles (fluid/solid/mixed): " << occupancy.tileCount[TILE_FLUID] << " / "
+              << occupancy.tileCount[TILE_SOLID] << " / " << occupancy.tileCount[TILE_MIXED] << std::endl;
+
+    // compulsory traffic per cell: every state texel read and written once in fluid and
+    // mixed tiles, plus the occupancy bit and (at most) the cell type in mixed tiles
+    size_t stateBytes = 0;
+    for (int j = 0; j < 3; j++)
+        stateBytes += imageElementSize(state[0][j]);
+    double tiles = (double)occupancy.tilesX * occupancy.tilesY;
+    lbmStats.bytesPerCell = (occupancy.tileCount[TILE_FLUID] * 2.0 * stateBytes +
+                             occupancy.tileCount[TILE_MIXED] * (2.0 * stateBytes + 0.125 + imageElementSize(cellType))) / tiles;
+    // the visualization variant adds the output texel, the velocity neighbours come from cache
+    visStats.bytesPerCell = lbmStats.bytesPerCell + 4 * sizeof(float);
+    resetStats.bytesPerCell = stateBytes;
+    rangeStats.bytesPerCell = sizeof(cl_float2) / (double)(THREAD_PER_BLOCK_DIM * THREAD_PER_BLOCK_DIM);
+    // velocity of the tile and its halo staged once per work-group, one byte written
+    double licTile = THREAD_PER_BLOCK_DIM + 2 * (LIC_LENGTH + 2);
+    licStats.bytesPerCell = licTile * licTile / (THREAD_PER_BLOCK_DIM * THREAD_PER_BLOCK_DIM) * imageElementSize(state[0][2]) + 1;
+
+    // arguments that stay the same for every step
+    for (cl::Kernel * k : { &kernel, &kernelVis }) {
+        k->setArg(0, cellType);                             // cell_type_tex
+        k->setArg(1, tileType);                             // tile_type
+        k->setArg(2, occupancyBits);                        // occupancy
+        k->setArg(3, occupancy.tilesX);                     // tiles_x
+        k->setArg(4, occupancy.pitch);                      // occupancy_pitch
+    }
+    kernelVis.setArg(21, visPartialRange);                  // vis_partial_range
+    kernelVis.setArg(29, nonFiniteBuffer);                  // non_finite
+    kernelRange.setArg(0, visPartialRange);                 // partial_range
+    kernelRange.setArg(1, occupancy.tilesX * occupancy.tilesY); // n
+    kernelRange.setArg(2, visRangeBuffer);                  // vis_range
+}
+
+void Simulation::reset(cl::CommandQueue & pQueue)
+{
+    // both buffers: lbm never writes solid tiles, whose state is read by the solid cells of
+    // neighbouring mixed tiles and would otherwise be whatever the allocation held
+    for (int b = 0; b < 2; b++) {
+        kernelReset.setArg(0, state[b][0]);                 // state_tex1
+        kernelReset.setArg(1, state[b][1]);                 // state_tex2
+        kernelReset.setArg(2, state[b][2]);                 // state_tex3
+        kernelReset.setArg(3, rhoInit);                     // init_rho
+        kernelReset.setArg(4, uxInit);                      // init_ux
+        kernelReset.setArg(5, uyInit);                      // init_uy
+        kernelReset.setArg(6, width);                       // image_size_x
+        kernelReset.setArg(7, height);                      // image_size_y
+        if (memberHeight > 0)
+            kernelReset.setArg(8, memberParams);            // member_params
+        else
+            kernelReset.setArg(8, sizeof(cl_mem), NULL);    // member_params
+        kernelReset.setArg(9, std::max(memberHeight, 1));   // member_size_y
+
+        cl::Event evKernel;
+        pQueue.enqueueNDRangeKernel(kernelReset, cl::NullRange, gridCfg, blockCfg, NULL, &evKernel);
+        pending.push_back({ &resetStats, evKernel, (double)width * height });
+    }
+
+    // solid tiles in the edge rows never write their part of the edge image either
+    for (int e = 0; e < 2; e++) {
+        if (edgeRow[e] < 0)
+            continue;
+        for (int j = 0; j < 3; j++) {
+            cl::size_t<3> src, dst, region;
+            src[1] = edgeRow[e];
+            dst[1] = 3 * e + j;
+            region[0] = width;
+            region[1] = 1;
+            region[2] = 1;
+            pQueue.enqueueCopyImage(state[readIdx][j], edgeState, src, dst, region);
+        }
+    }
+}
+
+void Simulation::setStepArgs(float mouseX, float mouseY, cl::Image * vis, int visMode)
+{
+    for (cl::Kernel * k : { &kernel, &kernelVis }) {
+        k->setArg(11, tau);                                 // tau
+        k->setArg(12, rhoInit);                             // boundary_rho
+        k->setArg(13, uxInit);                              // inlet_ux
+        k->setArg(14, uyInit);                              // inlet_uy
+        k->setArg(15, width);                               // image_size_x
+        k->setArg(16, height);                              // image_size_y
+        k->setArg(17, mouseX);                              // mouse_loc_x
+        k->setArg(18, mouseY);                              // mouse_loc_y
+    }
+    // the parameters of ensemble members and the edge rows follow the arguments of the visualization
+    int memberArg[2] = { 19, 24 };
+    cl::Kernel * memberKernel[2] = { &kernel, &kernelVis };
+    for (int i = 0; i < 2; i++) {
+        if (memberHeight > 0)
+            memberKernel[i]->setArg(memberArg[i], memberParams);        // member_params
+        else
+            memberKernel[i]->setArg(memberArg[i], sizeof(cl_mem), NULL); // member_params
+        memberKernel[i]->setArg(memberArg[i] + 1, std::max(memberHeight, 1)); // member_size_y
+        memberKernel[i]->setArg(memberArg[i] + 2, edgeState);           // edge_tex
+        memberKernel[i]->setArg(memberArg[i] + 3, edgeRow[0]);          // edge_row0
+        memberKernel[i]->setArg(memberArg[i] + 4, edgeRow[1]);          // edge_row1
+    }
+    if (vis) {
+        kernelVis.setArg(19, *vis);                         // vis_tex
+        kernelVis.setArg(20, visMode);                      // vis_mode
+        kernelVis.setArg(22, rangeRowBegin);                // range_y0
+        kernelVis.setArg(23, rangeRowEnd > 0 ? rangeRowEnd : height); // range_y1
+    }
+}
+
+void Simulation::setMembers(cl::Buffer & params, int pMemberHeight)
+{
+    memberParams = params;
+    memberHeight = pMemberHeight;
+}
+
+void Simulation::launchStep(cl::CommandQueue & pQueue, bool fused, const TileRect & rect,
+                            const std::vector<cl::Event> * waitList, cl::Event * done)
+{
+    cl::Kernel & k = fused ? kernelVis : kernel;
+    k.setArg(5, state[readIdx][0]);                         // src_state_tex1
+    k.setArg(6, state[readIdx][1]);                         // src_state_tex2
+    k.setArg(7, state[readIdx][2]);                         // src_state_tex3
+    k.setArg(8, state[1 - readIdx][0]);                     // dst_state_tex1
+    k.setArg(9, state[1 - readIdx][1]);                     // dst_state_tex2
+    k.setArg(10, state[1 - readIdx][2]);                    // dst_state_tex3
+
+    // the offset is whole tiles, so every work-group still covers exactly one tile
+    cl::NDRange offset(rect.x0 * THREAD_PER_BLOCK_DIM, rect.y0 * THREAD_PER_BLOCK_DIM);
+    cl::NDRange region((rect.x1 - rect.x0) * THREAD_PER_BLOCK_DIM, (rect.y1 - rect.y0) * THREAD_PER_BLOCK_DIM);
+    int cols = std::min(width, rect.x1 * THREAD_PER_BLOCK_DIM) - rect.x0 * THREAD_PER_BLOCK_DIM;
+    int rows = std::min(height, rect.y1 * THREAD_PER_BLOCK_DIM) - rect.y0 * THREAD_PER_BLOCK_DIM;
+
+    cl::Event evKernel;
+    pQueue.enqueueNDRangeKernel(k, offset, region, blockCfg, waitList, &evKernel);
+    pending.push_back({ fused ? &visStats : &lbmStats, evKernel, (double)cols * rows });
+    if (done)
+        *done = evKernel;
+}
+
+void Simulation::reduceRange(cl::CommandQueue & pQueue)
+{
+    // reduce the per-group ranges on device, only the final pair is read back
+    cl::Event evKernel;
+    cl::NDRange reduceCfg(THREAD_PER_BLOCK_DIM * THREAD_PER_BLOCK_DIM);
+    pQueue.enqueueNDRangeKernel(kernelRange, cl::NullRange, reduceCfg, reduceCfg, NULL, &evKernel);
+    pending.push_back({ &rangeStats, evKernel, (double)width * height });
+}
+
+void Simulation::step(cl::CommandQueue & pQueue, int steps, float mouseX, float mouseY,
+                      cl::Image * vis, int visMode, float * visRange, cl_uint * nonFinite)
+{
+    setStepArgs(mouseX, mouseY, vis, visMode);
+    if (vis && steps > 0)
+        pQueue.enqueueFillBuffer(nonFiniteBuffer, (cl_uint)0, 0, sizeof(cl_uint));
+
+    // the visualization is fused into the last step, the state images are swapped between steps
+    for (int s = 0; s < steps; s++) {
+        launchStep(pQueue, vis && s == steps - 1, { 0, 0, occupancy.tilesX, occupancy.tilesY }, NULL, NULL);
+        readIdx = 1 - readIdx;
+    }
+
+    if (vis && steps > 0) {
+        reduceRange(pQueue);
+        if (visRange)
+            pQueue.enqueueReadBuffer(visRangeBuffer, CL_FALSE, 0, 2 * sizeof(float), visRange);
+        if (nonFinite)
+            pQueue.enqueueReadBuffer(nonFiniteBuffer, CL_FALSE, 0, sizeof(cl_uint), nonFinite);
+    }
+}
+
+void Simulation::stepRegions(cl::CommandQueue & pQueue, const std::vector<TileRect> & edges, const std::vector<TileRect> & interior,
+                             const std::vector<cl::Event> * waitList, cl::Event & edgesDone,
+                             cl::Image * vis, int visMode)
+{
+    setStepArgs(-1.0f, -1.0f, vis, visMode);
+    if (vis)
+        pQueue.enqueueFillBuffer(nonFiniteBuffer, (cl_uint)0, 0, sizeof(cl_uint));
+
+    // in order, so the last edge launch finishing implies the others did
+    for (size_t i = 0; i < edges.size(); i++)
+        launchStep(pQueue, vis != NULL, edges[i], i == 0 ? waitList : NULL, i + 1 == edges.size() ? &edgesDone : NULL);
+    pQueue.flush();
+    for (const TileRect & rect : interior)
+        launchStep(pQueue, vis != NULL, rect, NULL, NULL);
+    readIdx = 1 - readIdx;
+    if (vis)
+        reduceRange(pQueue);
+}
+
+void Simulation::splitTiles(int edgeRows, std::vector<TileRect> & edges, std::vector<TileRect> & interior) const
+{
+    edges.clear();
+    interior.clear();
+    int topEnd = NUM_BLOCKS(edgeRows, THREAD_PER_BLOCK_DIM);
+    int bottomBegin = std::max(0, height - edgeRows) / THREAD_PER_BLOCK_DIM;
+    if (topEnd >= bottomBegin) {
+        // too few rows for an interior band
+        edges.push_back({ 0, 0, occupancy.tilesX, occupancy.tilesY });
+        return;
+    }
+    edges.push_back({ 0, 0, occupancy.tilesX, topEnd });
+    edges.push_back({ 0, bottomBegin, occupancy.tilesX, occupancy.tilesY });
+    interior.push_back({ 0, topEnd, occupancy.tilesX, bottomBegin });
+}
+
+void Simulation::stepEdgesFirst(cl::CommandQueue & pQueue, int edgeRows, const std::vector<cl::Event> * waitList, cl::Event & edgesDone,
+                                cl::Image * vis, int visMode)
+{
+    std::vector<TileRect> edges, interior;
+    splitTiles(edgeRows, edges, interior);
+    stepRegions(pQueue, edges, interior, waitList, edgesDone, vis, visMode);
+}
+
+void Simulation::lineIntegralConvolution(cl::CommandQueue & pQueue, cl::Image & lic)
+{
+    kernelLic.setArg(0, state[readIdx][2]);                 // state_tex3
+    kernelLic.setArg(1, lic);                               // lic_tex
+    kernelLic.setArg(2, width);                             // image_size_x
+    kernelLic.setArg(3, height);                            // image_size_y
+
+    cl::Event evKernel;
+    pQueue.enqueueNDRangeKernel(kernelLic, cl::NullRange, gridCfg, blockCfg, NULL, &evKernel);
+    pending.push_back({ &licStats, evKernel, (double)width * height });
+}
+
+void Simulation::finish(cl::CommandQueue & pQueue)
+{
+    pQueue.finish();
+    for (Launch & launch : pending)
+        recordKernel(*launch.stats, launch.event, launch.cells);
+    pending.clear();
+}
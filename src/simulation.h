@@ -0,0 +1,145 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "cell_type.h"
+#include "device_pool.h"
+#include "perf_util.h"
+
+// CL threadblock config, one lattice tile per work-group
+#define THREAD_PER_BLOCK_DIM 16
+#define NUM_BLOCKS(n, block_size) (((n) + (block_size) - 1) / (block_size))
+
+// streamline half length of the line integral convolution, in cells
+#define LIC_LENGTH 10
+
+// Quantity written by the visualization variant of the lbm kernel
+enum VisMode { VIS_VELOCITY = 0, VIS_VORTICITY, VIS_PRESSURE, VIS_QCRITERION, VIS_MODE_COUNT };
+
+inline const char * visModeName(int mode)
+{
+    static const char * names[VIS_MODE_COUNT] = { "velocity", "vorticity", "pressure", "qcriterion" };
+    return names[mode];
+}
+
+// signed quantities are shown over a range centered at zero
+inline bool visModeSigned(int mode)
+{
+    return mode == VIS_VORTICITY || mode == VIS_QCRITERION;
+}
+
+// Load and build lbm.cl with the definitions shared with the host
+cl::Program buildProgram(cl::Context & pContext, cl::Device & pDevice);
+cl::Program buildProgram(cl::Context & pContext, std::vector<cl::Device> & pDevices);
+
+// Tiles [x0, x1) x [y0, y1) of a partial lbm launch
+struct TileRect {
+    int x0, y0, x1, y1;
+};
+
+// Lattice state and kernels of one simulated domain, kept in plain CL images.
+// All calls only enqueue work; finish() waits and accounts the kernel times,
+// which requires a queue created with CL_QUEUE_PROFILING_ENABLE.
+class Simulation
+{
+public:
+    int width = 0, height = 0;
+    cl::Image2D cellType;               // 8-bit cell type map
+    cl::Image2D state[2][3];            // double buffer, one for read, one for write
+    int readIdx = 0;                    // buffer holding the latest state
+    Occupancy occupancy;
+    cl::Buffer tileType, occupancyBits; // per-tile summary and 1-bit fluid bitmap
+    cl::Image2D wallDistance;           // signed distance to the walls in cells, negative inside;
+                                        // set for procedural geometries only, see rasterizeGeometry
+    // the latest state of rows edgeRow[0] and edgeRow[1], their three state texels in rows 0-2
+    // and 3-5, written by every step along with the state; -1 for none. Another queue may read
+    // it while stepRegions() computes the interior, but not once the next step has begun.
+    cl::Image2D edgeState;
+    int edgeRow[2] = { -1, -1 };
+
+    float tau = 0.58f;
+    float rhoInit = 1.0f;
+    float uxInit = 0.3f, uyInit = 0.06f;
+    int rangeRowBegin = 0, rangeRowEnd = 0; // rows counted in the visualization range, all by default
+    int memberHeight = 0;                   // rows per ensemble member, 0: a single lattice
+
+    KernelStats lbmStats{"lbm"}, resetStats{"resetFluid"}, visStats{"lbmVis"}, rangeStats{"reduceRange"}, licStats{"lineIntegralConvolution"};
+
+    Simulation() {}
+    // with a _lease_, the lattice images and buffers are taken from its pool and go back with
+    // the lease, once the last copy of this simulation and its other holders are gone
+    Simulation(cl::Context & pContext, cl::Program & pProgram, int pWidth, int pHeight,
+               std::shared_ptr<DevicePoolLease> pLease = NULL);
+
+    // resample a mask of cell types (CL_R, CL_UNSIGNED_INT8) to the lattice,
+    // cells within _margin_ of the lattice edge become solid. A slab of a taller lattice
+    // passes the lattice row of its row 0 and the lattice height, rows outside wrap around.
+    void initCellTypes(cl::CommandQueue & pQueue, cl::Image2D & mask, int maskWidth, int maskHeight, int margin,
+                       int originY = 0, int latticeHeight = 0);
+    // the two parts of initCellTypes: resampling into rows [rowBegin, rowBegin + rows) only,
+    // whose first row is lattice row _originY_, and deriving the tile summaries of all rows
+    void resampleCellTypes(cl::CommandQueue & pQueue, cl::Image2D & mask, int maskWidth, int maskHeight, int margin,
+                           int originY, int latticeHeight, int rowBegin, int rows);
+    void summarizeCellTypes(cl::CommandQueue & pQueue);
+    // stack equally high members with their own parameters, one (tau, rhoInit, uxInit, uyInit)
+    // float4 each in _params_, instead of the scalars above; 0 returns to a single lattice
+    void setMembers(cl::Buffer & params, int memberHeight);
+    // write the line integral convolution of the latest velocity to an 8-bit or float
+    // single channel image, white noise smeared along the streamlines
+    void lineIntegralConvolution(cl::CommandQueue & pQueue, cl::Image & lic);
+    // set both state buffers, and the edge rows, to equilibrium at the initial density and velocity,
+    // those of its member for each row of an ensemble
+    void reset(cl::CommandQueue & pQueue);
+    // advance _steps_ time steps, injecting density at lattice position (mouseX, mouseY).
+    // With _vis_ given, the last step also writes the _visMode_ quantity of the new
+    // state to that RGBA float image: x is the quantity, y is 1 in non-solid and 0 in solid cells.
+    // The (min, max) of the quantity over non-solid cells is left in visRangeDevice() and,
+    // if _visRange_ is given, read into it by finish(), as is the number of those cells whose
+    // state is no longer finite into _nonFinite_. The range alone passes over NaN cells.
+    void step(cl::CommandQueue & pQueue, int steps, float mouseX = -1.0f, float mouseY = -1.0f,
+              cl::Image * vis = NULL, int visMode = VIS_VELOCITY, float * visRange = NULL,
+              cl_uint * nonFinite = NULL);
+    // a single step launched over the _edges_ tile rectangles, after _waitList_, and then
+    // over _interior_, which together cover the lattice once. _edgesDone_ signals the edges,
+    // so that their rows can be sent while the interior is computed. Needs an in-order queue.
+    void stepRegions(cl::CommandQueue & pQueue, const std::vector<TileRect> & edges, const std::vector<TileRect> & interior,
+                     const std::vector<cl::Event> * waitList, cl::Event & edgesDone,
+                     cl::Image * vis = NULL, int visMode = VIS_VELOCITY);
+    // split into the bands of whole tile rows holding the first and last _edgeRows_ rows and
+    // the interior between them, which reads none of the first and last _edgeRows_ - 1 rows
+    void splitTiles(int edgeRows, std::vector<TileRect> & edges, std::vector<TileRect> & interior) const;
+    // stepRegions() over splitTiles(_edgeRows_)
+    void stepEdgesFirst(cl::CommandQueue & pQueue, int edgeRows, const std::vector<cl::Event> * waitList, cl::Event & edgesDone,
+                        cl::Image * vis = NULL, int visMode = VIS_VELOCITY);
+    void finish(cl::CommandQueue & pQueue);
+
+    cl::Buffer & visRangeDevice() { return visRangeBuffer; }
+
+    std::vector<KernelStats *> stats() { return { &lbmStats, &visStats, &rangeStats, &licStats, &resetStats }; }
+
+private:
+    cl::Context context;
+    cl::Program program;
+    std::shared_ptr<DevicePoolLease> lease;
+    cl::Kernel kernel, kernelVis, kernelRange, kernelLic, kernelReset;
+    cl::Buffer visPartialRange, visRangeBuffer; // per work-group and total (min, max) of lbmVis
+    cl::Buffer nonFiniteBuffer;         // cells of the last lbmVis launches with a non-finite state
+    cl::Buffer memberParams;
+    cl::NDRange blockCfg, gridCfg;
+    struct Launch {
+        KernelStats * stats;
+        cl::Event event;
+        double cells;
+    };
+    std::vector<Launch> pending;        // launches not yet accounted
+
+    void setStepArgs(float mouseX, float mouseY, cl::Image * vis, int visMode);
+    // update the tiles of _rect_ into the write buffer, without swapping
+    void launchStep(cl::CommandQueue & pQueue, bool fused, const TileRect & rect,
+                    const std::vector<cl::Event> * waitList, cl::Event * done);
+    void reduceRange(cl::CommandQueue & pQueue);
+};
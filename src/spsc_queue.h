@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free bounded queue for one producer thread and one consumer thread.
+// push() fails instead of blocking when the queue is full.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+    bool push(const T & item)
+    {
+        size_t tail = tailIdx.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % (Capacity + 1);
+        if (next == headIdx.load(std::memory_order_acquire))
+            return false;
+        items[tail] = item;
+        tailIdx.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T & item)
+    {
+        size_t head = headIdx.load(std::memory_order_relaxed);
+        if (head == tailIdx.load(std::memory_order_acquire))
+            return false;
+        item = items[head];
+        headIdx.store((head + 1) % (Capacity + 1), std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[Capacity + 1];
+    std::atomic<size_t> headIdx{0};     // next item to pop, written by the consumer
+    std::atomic<size_t> tailIdx{0};     // next free slot, written by the producer
+};
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "cl_util.h"
+#include "colormap.h"
+#include "device_pool.h"
+#include "geometry.h"
+#include "headless.h"
+#include "mask.h"
+#include "offscreen.h"
+#include "simulation.h"
+#include "sweep.h"
+
+bool loadSweep(const std::string & path, const std::string & defaultMask, std::vector<SweepJob> & jobs)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Unable to read sweep " << path << std::endl;
+        return false;
+    }
+
+    std::map<std::string, std::vector<std::string>> values;
+    std::string line;
+    for (int lineNo = 1; std::getline(file, line); lineNo++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string name, value;
+        if (!(fields >> name))
+            continue;
+        bool ok = name == "tau" || name == "re" || name == "ux" || name == "uy" || name == "mask";
+        while (ok && fields >> value) {
+            if (name != "mask") {
+                char * end;
+                float v = strtof(value.c_str(), &end);
+                ok = *end == 0 && (name == "tau" ? v > 0.5f : name == "re" ? v > 0.0f : true);
+            }
+            values[name].push_back(value);
+        }
+        if (!ok || values[name].empty() || (values.count("tau") && values.count("re"))) {
+            std::cout << path << ":" << lineNo << ": expected tau (> 0.5), re (> 0), ux, uy or mask and its values,"
+                      << " tau and re exclude each other" << std::endl;
+            return false;
+        }
+    }
+
+    // every combination, the masks outermost
+    SweepJob base;
+    std::vector<std::string> masks = values.count("mask") ? values["mask"] : std::vector<std::string>{ defaultMask };
+    std::vector<std::string> taus = values.count("tau") ? values["tau"] : std::vector<std::string>{ std::to_string(base.tau) };
+    std::vector<std::string> res = values.count("re") ? values["re"] : std::vector<std::string>{ "0" };
+    std::vector<std::string> uxs = values.count("ux") ? values["ux"] : std::vector<std::string>{ std::to_string(base.ux) };
+    std::vector<std::string> uys = values.count("uy") ? values["uy"] : std::vector<std::string>{ std::to_string(base.uy) };
+    for (const std::string & mask : masks)
+        for (const std::string & tau : taus)
+            for (const std::string & re : res)
+                for (const std::string & ux : uxs)
+                    for (const std::string & uy : uys) {
+                        SweepJob job;
+                        job.index = (int)jobs.size();
+                        job.maskPath = mask;
+                        job.tau = strtof(tau.c_str(), NULL);
+                        job.re = strtof(re.c_str(), NULL);
+                        job.ux = strtof(ux.c_str(), NULL);
+                        job.uy = strtof(uy.c_str(), NULL);
+                        jobs.push_back(job);
+                    }
+    return true;
+}
+
+namespace {
+
+// cell types and lattice size of a mask, loaded once and shared by the workers. Geometry
+// files are kept as their shapes and evaluated by each job on its device.
+struct SweepMask {
+    std::vector<unsigned char> cellTypes;
+    bool procedural = false;
+    Geometry geometry;
+    int maskWidth = 0, maskHeight = 0;
+    int width = 0, height = 0;
+};
+
+// state shared by the workers, read only but for the log and the diagnostics file
+struct SweepShared {
+    const Options * opts;
+    int visMode, colormap;
+    cl::Context context;
+    cl::Program program;
+    std::unique_ptr<DevicePool> pool;   // lattices of a size another worker left behind
+    std::vector<SweepJob> jobs;
+    std::map<std::string, SweepMask> masks;
+    std::mutex logMutex;
+    std::ofstream csv;
+};
+
+// one per device: its queue, the buffers kept between jobs and the jobs dealt to it
+struct SweepWorker {
+    cl::Device device;
+    std::string deviceName;
+    cl::CommandQueue queue;
+    std::unique_ptr<Simulation> sim;
+    std::unique_ptr<OffscreenRenderer> renderer;
+    std::shared_ptr<DevicePoolLease> lease;     // the pool objects of sim and renderer
+    std::mutex jobsMutex;
+    std::deque<int> jobs;
+    int stolen = 0;
+};
+
+// next job of worker _self_: the front of its own queue, else the back of the longest other
+// queue, the jobs its owner would reach last. No jobs are added once the workers run.
+bool takeJob(std::vector<std::unique_ptr<SweepWorker>> & workers, size_t self, int & job)
+{
+    {
+        std::lock_guard<std::mutex> lock(workers[self]->jobsMutex);
+        if (!workers[self]->jobs.empty()) {
+            job = workers[self]->jobs.front();
+            workers[self]->jobs.pop_front();
+            return true;
+        }
+    }
+    for (;;) {
+        size_t victim = self, most = 0;
+        for (size_t i = 0; i < workers.size(); i++) {
+            std::lock_guard<std::mutex> lock(workers[i]->jobsMutex);
+            if (workers[i]->jobs.size() > most) {
+                most = workers[i]->jobs.size();
+                victim = i;
+            }
+        }
+        if (most == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(workers[victim]->jobsMutex);
+        if (!workers[victim]->jobs.empty()) {
+            job = workers[victim]->jobs.back();
+            workers[victim]->jobs.pop_back();
+            workers[self]->stolen++;
+            return true;
+        }
+    }
+}
+
+// give the pool objects of the worker back, once its queue is done with them; if the queue
+// cannot be finished the pool drops them, another worker must not get them while still in use
+void releaseBuffers(SweepWorker & worker)
+{
+    if (worker.lease) {
+        try {
+            worker.queue.finish();
+        } catch(cl::Error err) {
+            worker.lease->forget();
+        }
+    }
+    worker.renderer.reset();
+    worker.sim.reset();
+    worker.lease.reset();
+}
+
+void runJob(SweepShared & shared, SweepWorker & worker, const SweepJob & job)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Options & opts = *shared.opts;
+    const SweepMask & mask = shared.masks.at(job.maskPath);
+
+    // kept while the lattice size stays the same, else the buffers go back to the pool
+    if (!worker.sim || worker.sim->width != mask.width || worker.sim->height != mask.height) {
+        releaseBuffers(worker);
+        worker.lease = std::make_shared<DevicePoolLease>(shared.context, shared.pool.get());
+        worker.sim.reset(new Simulation(shared.context, shared.program, mask.width, mask.height, worker.lease));
+        worker.renderer.reset(new OffscreenRenderer(shared.context, worker.queue, shared.program, mask.width, mask.height,
+                                                    shared.colormap, opts.outputFormat, worker.lease));
+    }
+    Simulation & sim = *worker.sim;
+
+    // nu = (tau - 0.5) / 3 in lattice units, Re = ux * height / nu
+    float tau = job.re > 0.0f ? 0.5f + 3.0f * job.ux * mask.height / job.re : job.tau;
+    float re = job.re > 0.0f ? job.re : job.ux * mask.height * 3.0f / (tau - 0.5f);
+    sim.tau = tau;
+    sim.uxInit = job.ux;
+    sim.uyInit = job.uy;
+
+    cl::Image2D maskImage;
+    if (mask.procedural) {
+        rasterizeGeometry(shared.context, worker.queue, shared.program, mask.geometry, mask.width, mask.height, maskImage);
+        sim.initCellTypes(worker.queue, maskImage, mask.width, mask.height, 2);
+    } else {
+        maskImage = cl::Image2D(shared.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_R, CL_UNSIGNED_INT8),
+                                mask.maskWidth, mask.maskHeight, 0, (void *)mask.cellTypes.data());
+        sim.initCellTypes(worker.queue, maskImage, mask.maskWidth, mask.maskHeight, 2);
+    }
+    sim.reset(worker.queue);
+    sim.finish(worker.queue);
+    for (KernelStats * s : sim.stats())
+        *s = KernelStats{s->name, s->bytesPerCell};
+
+    // the range of the quantity is checked every outputEvery steps, a diverged run stops there
+    Clock::time_point start = Clock::now();
+    float range[2] = { 0.0f, 0.0f };
+    cl_uint nonFinite = 0;
+    long long step = 0;
+    bool diverged = false;
+    while (step < opts.steps && !diverged) {
+        int steps = (int)std::min((long long)opts.outputEvery, opts.steps - step);
+        step += steps;
+        sim.step(worker.queue, steps, -1.0f, -1.0f, &worker.renderer->vis, shared.visMode, range, &nonFinite);
+        sim.finish(worker.queue);
+        diverged = nonFinite > 0 || !std::isfinite(range[0]) || !std::isfinite(range[1]);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double cells = sim.lbmStats.cells + sim.visStats.cells;
+    double deviceSeconds = sim.lbmStats.seconds + sim.visStats.seconds;
+    double mlups = deviceSeconds > 0.0 ? cells / deviceSeconds * 1e-6 : 0.0;
+
+    if (!diverged) {
+        std::string path = opts.outputPrefix + "_run" + std::to_string(job.index) + "." + opts.outputFormat;
+        worker.renderer->write(worker.queue, sim.visRangeDevice(), shared.visMode, path);
+        worker.renderer->finish(worker.queue);
+    }
+
+    std::lock_guard<std::mutex> lock(shared.logMutex);
+    shared.csv << job.index << "," << worker.deviceName << "," << job.maskPath << "," << mask.width << "," << mask.height
+               << "," << tau << "," << re << "," << job.ux << "," << job.uy << "," << step << "," << seconds << "," << mlups
+               << "," << range[0] << "," << range[1] << "," << (diverged ? "diverged" : "ok") << std::endl;
+    std::cout << "run " << job.index << " on " << worker.deviceName << ": tau " << tau << ", Re " << re << ", "
+              << step << " steps in " << seconds << " s, " << mlups << " MLUPS" << (diverged ? ", diverged" : "") << std::endl;
+}
+
+void workerLoop(SweepShared & shared, std::vector<std::unique_ptr<SweepWorker>> & workers, size_t self)
+{
+    SweepWorker & worker = *workers[self];
+    int job;
+    while (takeJob(workers, self, job)) {
+        try {
+            runJob(shared, worker, shared.jobs[job]);
+        } catch(cl::Error err) {
+            // the next run starts over with buffers taken afresh
+            releaseBuffers(worker);
+            std::lock_guard<std::mutex> lock(shared.logMutex);
+            shared.csv << job << "," << worker.deviceName << "," << shared.jobs[job].maskPath
+                       << ",,,,,,,,,,,,error " << err.err() << std::endl;
+            std::cout << "run " << job << " on " << worker.deviceName << ": " << err.what() << "(" << err.err() << ")" << std::endl;
+        }
+    }
+    releaseBuffers(worker);
+}
+
+}
+
+int runSweep(const Options & opts)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    SweepShared shared;
+    shared.opts = &opts;
+    shared.visMode = findName(opts.visName, VIS_MODE_COUNT, visModeName);
+    if (shared.visMode < 0) {
+        std::cout << "Unknown quantity " << opts.visName << std::endl;
+        return 1;
+    }
+    shared.colormap = visModeSigned(shared.visMode) ? COLORMAP_COOLWARM : COLORMAP_VIRIDIS;
+    if (!opts.colormapName.empty()) {
+        shared.colormap = findName(opts.colormapName, COLORMAP_COUNT, colormapName);
+        if (shared.colormap < 0) {
+            std::cout << "Unknown colormap " << opts.colormapName << std::endl;
+            return 1;
+        }
+    }
+
+    if (!loadSweep(opts.sweepPath, opts.maskPath, shared.jobs))
+        return 1;
+    for (const SweepJob & job : shared.jobs) {
+        if (shared.masks.count(job.maskPath))
+            continue;
+        SweepMask & mask = shared.masks[job.maskPath];
+        mask.procedural = isGeometryPath(job.maskPath);
+        if (mask.procedural) {
+            if (!loadGeometry(job.maskPath.c_str(), mask.geometry))
+                return 1;
+            mask.maskWidth = mask.geometry.width;
+            mask.maskHeight = mask.geometry.height;
+        } else if (!loadMask(job.maskPath.c_str(), mask.cellTypes, mask.maskWidth, mask.maskHeight)) {
+            return 1;
+        }
+        latticeSize(opts, mask.maskWidth, mask.maskHeight, mask.width, mask.height);
+    }
+
+    std::string csvPath = opts.outputPrefix + "_sweep.csv";
+    shared.csv.open(csvPath);
+    if (!shared.csv) {
+        std::cout << "Unable to write " << csvPath << std::endl;
+        return 1;
+    }
+    shared.csv << "run,device,mask,width,height,tau,re,ux,uy,steps,seconds,mlups,vis_min,vis_max,status" << std::endl;
+
+    std::vector<std::unique_ptr<SweepWorker>> workers;
+    try {
+        // every device of the platform in one context, so the program is built once
+        cl::Platform plat = getPlatform();
+        std::vector<cl::Device> vDevices;
+        plat.getDevices(CL_DEVICE_TYPE_ALL, &vDevices);
+        if (vDevices.empty()) {
+            std::cout << "No OpenCL device found" << std::endl;
+            return 1;
+        }
+        shared.context = cl::Context(vDevices);
+        shared.program = buildProgram(shared.context, vDevices);
+        shared.pool.reset(new DevicePool(shared.context));
+
+        for (cl::Device & device : vDevices) {
+            workers.emplace_back(new SweepWorker);
+            SweepWorker & worker = *workers.back();
+            worker.device = device;
+            std::string deviceName = device.getInfo<CL_DEVICE_NAME>();
+            worker.deviceName = deviceName;
+            worker.queue = cl::CommandQueue(shared.context, device, CL_QUEUE_PROFILING_ENABLE);
+        }
+    } catch(cl::Error err) {
+        std::cout << err.what() << "(" << err.err() << ")" << std::endl;
+        return 1;
+    }
+
+    // contiguous blocks, so that a worker runs jobs of one lattice size back to back
+    size_t jobCount = shared.jobs.size();
+    for (size_t w = 0; w < workers.size(); w++)
+        for (size_t j = jobCount * w / workers.size(); j < jobCount * (w + 1) / workers.size(); j++)
+            workers[w]->jobs.push_back((int)j);
+    std::cout << jobCount << " runs on " << workers.size() << " devices" << std::endl;
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers.size(); w++)
+        threads.emplace_back(workerLoop, std::ref(shared), std::ref(workers), w);
+    for (std::thread & t : threads)
+        t.join();
+
+    for (std::unique_ptr<SweepWorker> & worker : workers)
+        std::cout << worker->deviceName << ": " << worker->stolen << " runs stolen" << std::endl;
+    workers.clear();
+    shared.pool->report("device pool");
+    std::cout << "sweep done in " << std::chrono::duration<double>(Clock::now() - start).count()
+              << " s, diagnostics in " << csvPath << std::endl;
+    return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "options.h"
+
+// One run of a parameter sweep
+struct SweepJob {
+    int index = 0;
+    std::string maskPath;
+    float tau = 0.58f;
+    float re = 0.0f;                    // Reynolds number over the lattice height, >0: sets tau
+    float ux = 0.3f, uy = 0.06f;        // inlet velocity
+};
+
+// Read a parameter grid, one parameter per line followed by its values:
+//   tau <values> | re <values> | ux <values> | uy <values> | mask <paths>
+// '#' starts a comment, tau and re exclude each other. The runs are every combination,
+// masks outermost so that runs of the same lattice size are adjacent.
+// Returns false (after printing the line) on malformed lines.
+bool loadSweep(const std::string & path, const std::string & defaultMask, std::vector<SweepJob> & jobs);
+
+// Run every job of the grid in opts.sweepPath on all devices of the platform, one
+// worker thread and queue per device. Jobs are dealt out in contiguous blocks and a
+// worker that runs out steals from the back of the longest queue. The program is built
+// once and a worker keeps its lattice and image buffers between jobs of the same size.
+// Each run writes its final image to <prefix>_run<index>.<format> and a line of
+// diagnostics to <prefix>_sweep.csv. Returns the process exit code.
+int runSweep(const Options & opts);
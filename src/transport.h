@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// message tags of a distributed run
+enum TransportTag {
+    TAG_HALO_TOP = 0,       // first own row of the sender
+    TAG_HALO_BOTTOM,        // last own row of the sender
+    TAG_RANGE,              // (min, max) of the visualized quantity
+    TAG_COUNT
+};
+
+// Moves messages between the processes of a distributed run. Messages from one peer
+// with one tag arrive in the order they were sent. send() may return before the message
+// is delivered, but _data_ can be reused as soon as it returns; recv() blocks until the
+// message arrived.
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+    virtual void send(int peer, int tag, const void * data, size_t bytes) = 0;
+    virtual void recv(int peer, int tag, void * data, size_t bytes) = 0;
+    virtual void barrier() = 0;
+};
+
+// Processes of one machine exchanging messages through a named shared memory segment of
+// per-peer mailboxes, rank 0 creates it. Messages are at most _maxBytes_. Returns NULL
+// (after printing why) if the segment cannot be created or opened.
+std::unique_ptr<Transport> createSharedMemoryTransport(const std::string & name, int rank, int size, size_t maxBytes);
+
+#ifdef LBMCL_WITH_MPI
+// MPI_COMM_WORLD, initializing and finalizing MPI
+std::unique_ptr<Transport> createMpiTransport();
+#endif
@@ -0,0 +1,68 @@
+#ifdef LBMCL_WITH_MPI
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+#include "transport.h"
+
+namespace {
+
+class MpiTransport : public Transport
+{
+public:
+    MpiTransport()
+    {
+        MPI_Init(NULL, NULL);
+        MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
+        MPI_Comm_size(MPI_COMM_WORLD, &count);
+    }
+
+    ~MpiTransport()
+    {
+        for (auto & out : outgoing)
+            MPI_Wait(&out.second.request, MPI_STATUS_IGNORE);
+        MPI_Finalize();
+    }
+
+    int rank() const override { return myRank; }
+    int size() const override { return count; }
+
+    void send(int peer, int tag, const void * data, size_t bytes) override
+    {
+        // one message in flight per peer and tag, its copy is kept until the next send
+        Outgoing & out = outgoing[std::make_pair(peer, tag)];
+        if (out.request != MPI_REQUEST_NULL)
+            MPI_Wait(&out.request, MPI_STATUS_IGNORE);
+        const unsigned char * bytesIn = (const unsigned char *)data;
+        out.data.assign(bytesIn, bytesIn + bytes);
+        MPI_Isend(out.data.data(), (int)bytes, MPI_BYTE, peer, tag, MPI_COMM_WORLD, &out.request);
+    }
+
+    void recv(int peer, int tag, void * data, size_t bytes) override
+    {
+        MPI_Recv(data, (int)bytes, MPI_BYTE, peer, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+
+    void barrier() override { MPI_Barrier(MPI_COMM_WORLD); }
+
+private:
+    struct Outgoing {
+        std::vector<unsigned char> data;
+        MPI_Request request = MPI_REQUEST_NULL;
+    };
+
+    int myRank = 0, count = 1;
+    std::map<std::pair<int, int>, Outgoing> outgoing;
+};
+
+} // namespace
+
+std::unique_ptr<Transport> createMpiTransport()
+{
+    return std::unique_ptr<Transport>(new MpiTransport());
+}
+
+#endif
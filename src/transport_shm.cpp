@@ -0,0 +1,428 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "transport.h"
+
+#define MAILBOX_SLOTS 4             // messages in flight per sender, receiver and tag
+#define SEGMENT_MAGIC 0x6c626d63u   // set by rank 0 once the segment is initialized
+#define OPEN_TIMEOUT 60             // seconds the ranks wait for each other to open the transport
+#define PEER_CHECK_MS 100           // interval of the checks for exited peers while blocked
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Counters live in the shared segment, which starts zeroed; std::atomic of
+// these sizes is lock-free and has no other state on the supported platforms.
+struct SegmentHeader {
+    std::atomic<uint32_t> magic;
+    std::atomic<uint32_t> stale;        // set by rank 0 of a later run, or when this one failed to start
+    std::atomic<uint32_t> barrierCount;
+    std::atomic<uint32_t> barrierGeneration;
+};
+
+// A segment left by a run that did not end cleanly still holds its magic and counters, so
+// the other ranks do not trust a segment before rank 0 has accepted the nonce they picked
+// for this run, which the rank 0 of a stale segment never does
+struct JoinSlot {
+    std::atomic<uint64_t> nonce;    // put by the joining rank
+    std::atomic<uint64_t> accepted; // the nonce, copied by rank 0
+    std::atomic<uint64_t> pid;      // of the rank, to notice it exiting
+    uint64_t pad[5];
+};
+
+// The segment of a run is named after a nonce of its rank 0, published under the name of
+// the transport, so that a new run never has to reuse a segment an old process still maps
+struct Rendezvous {
+    std::atomic<uint64_t> runId;
+};
+
+struct Mailbox {
+    std::atomic<uint64_t> written;  // messages put by the sender
+    std::atomic<uint64_t> read;     // messages taken by the receiver
+    uint64_t pad[6];                // keep the counters of neighbouring mailboxes off this cache line
+};
+
+enum MapMode { MAP_CREATE, MAP_OPEN_OR_CREATE, MAP_OPEN };
+
+// A named shared memory object: created anew (failing if the name exists), created or
+// opened, or only opened if it exists and holds at least _bytes_
+struct SharedMapping {
+    unsigned char * base = NULL;
+    size_t bytes = 0;
+    std::string name;
+#ifdef _WIN32
+    HANDLE handle = NULL;
+#endif
+
+    bool map(const std::string & pName, size_t pBytes, MapMode mode);
+    void unmap();
+    // remove the name, mappings stay valid until unmapped
+    void unlink();
+};
+
+bool SharedMapping::map(const std::string & pName, size_t pBytes, MapMode mode)
+{
+    bytes = pBytes;
+#ifdef _WIN32
+    name = "Local\\" + pName;
+    if (mode == MAP_OPEN)
+        handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    else
+        handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                    (DWORD)((unsigned long long)bytes >> 32), (DWORD)bytes, name.c_str());
+    if (handle != NULL && mode == MAP_CREATE && GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(handle);
+        handle = NULL;
+    }
+    if (handle == NULL)
+        return false;
+    base = (unsigned char *)MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+    if (base == NULL) {
+        CloseHandle(handle);
+        handle = NULL;
+    }
+#else
+    name = "/" + pName;
+    int flags = mode == MAP_CREATE ? O_CREAT | O_EXCL | O_RDWR : mode == MAP_OPEN_OR_CREATE ? O_CREAT | O_RDWR : O_RDWR;
+    int fd = shm_open(name.c_str(), flags, 0600);
+    if (fd < 0)
+        return false;
+    // an opened object may not be sized yet by its creator
+    struct stat st;
+    bool sized = fstat(fd, &st) == 0 && (size_t)st.st_size >= bytes;
+    if (!sized && mode != MAP_OPEN)
+        sized = ftruncate(fd, (off_t)bytes) == 0;
+    void * ptr = sized ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    base = ptr == MAP_FAILED ? NULL : (unsigned char *)ptr;
+#endif
+    return base != NULL;
+}
+
+void SharedMapping::unmap()
+{
+    if (base == NULL)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(handle);
+    handle = NULL;
+#else
+    munmap(base, bytes);
+#endif
+    base = NULL;
+}
+
+void SharedMapping::unlink()
+{
+#ifndef _WIN32
+    shm_unlink(name.c_str());   // a named mapping goes away with its last handle on Windows
+#endif
+}
+
+uint64_t currentPid()
+{
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return (uint64_t)getpid();
+#endif
+}
+
+// 0 is a rank that did not put its pid yet
+bool processAlive(uint64_t pid)
+{
+    if (pid == 0)
+        return true;
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (process == NULL)
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+uint64_t makeNonce()
+{
+    std::random_device device;
+    uint64_t nonce = ((uint64_t)device() << 32 | device()) ^ (uint64_t)Clock::now().time_since_epoch().count();
+    return nonce | 1;   // zero is an empty slot
+}
+
+std::string segmentName(const std::string & name, uint64_t runId)
+{
+    std::ostringstream s;
+    s << name << "_" << std::hex << runId;
+    return s.str();
+}
+
+class SharedMemoryTransport : public Transport
+{
+public:
+    SharedMemoryTransport(int pRank, int pSize, size_t pMaxBytes)
+        : myRank(pRank), count(pSize), maxBytes(pMaxBytes) {}
+    ~SharedMemoryTransport();
+
+    bool open(const std::string & name);
+
+    int rank() const override { return myRank; }
+    int size() const override { return count; }
+
+    void send(int peer, int tag, const void * data, size_t bytes) override
+    {
+        Mailbox & box = mailbox(myRank, peer, tag);
+        uint64_t n = box.written.load(std::memory_order_relaxed);
+        waitFor(peer, [&] { return n - box.read.load(std::memory_order_acquire) < MAILBOX_SLOTS; });
+        memcpy(slot(myRank, peer, tag, n), data, bytes);
+        box.written.store(n + 1, std::memory_order_release);
+    }
+
+    void recv(int peer, int tag, void * data, size_t bytes) override
+    {
+        Mailbox & box = mailbox(peer, myRank, tag);
+        uint64_t n = box.read.load(std::memory_order_relaxed);
+        waitFor(peer, [&] { return box.written.load(std::memory_order_acquire) != n; });
+        memcpy(data, slot(peer, myRank, tag, n), bytes);
+        box.read.store(n + 1, std::memory_order_release);
+    }
+
+    void barrier() override
+    {
+        SegmentHeader & h = header();
+        uint32_t generation = h.barrierGeneration.load(std::memory_order_acquire);
+        if (h.barrierCount.fetch_add(1, std::memory_order_acq_rel) + 1 == (uint32_t)count) {
+            h.barrierCount.store(0, std::memory_order_relaxed);
+            h.barrierGeneration.fetch_add(1, std::memory_order_release);
+        } else {
+            waitFor(-1, [&] { return h.barrierGeneration.load(std::memory_order_acquire) != generation; });
+        }
+    }
+
+private:
+    int myRank, count;
+    size_t maxBytes;
+    size_t segmentBytes = 0;
+    uint64_t runId = 0;
+    SharedMapping rendezvous, segment;
+    unsigned char * base = NULL;        // of the segment
+    bool broken = false;                // a peer exited, the closing barrier is skipped
+
+    SegmentHeader & header() { return *(SegmentHeader *)base; }
+    Rendezvous & published() { return *(Rendezvous *)rendezvous.base; }
+
+    // the header, one join slot per rank, the mailboxes and their message slots, a cache line
+    // each but the last
+    JoinSlot & join(int r) { return ((JoinSlot *)(base + sizeof(Mailbox)))[r]; }
+
+    size_t boxIndex(int from, int to, int tag) const { return ((size_t)from * count + to) * TAG_COUNT + tag; }
+
+    Mailbox & mailbox(int from, int to, int tag)
+    {
+        Mailbox * boxes = (Mailbox *)(base + (1 + count) * sizeof(Mailbox));
+        return boxes[boxIndex(from, to, tag)];
+    }
+
+    unsigned char * slot(int from, int to, int tag, uint64_t n)
+    {
+        size_t boxes = (size_t)count * count * TAG_COUNT;
+        unsigned char * data = base + (1 + count + boxes) * sizeof(Mailbox);
+        return data + (boxIndex(from, to, tag) * MAILBOX_SLOTS + n % MAILBOX_SLOTS) * maxBytes;
+    }
+
+    // spin until _done_, checking every PEER_CHECK_MS that _peer_ (all peers for -1) is
+    // still running and the segment still in use; throws std::runtime_error if not
+    template <typename F> void waitFor(int peer, F done);
+    // wait until _done_ or OPEN_TIMEOUT after _start_; false if the segment turned stale,
+    // rank 0 exited or the time ran out
+    template <typename F> bool waitOpen(Clock::time_point start, F done);
+    bool create(const std::string & name);
+    // map the segment of rank 0 of this run, false after OPEN_TIMEOUT
+    bool attach(const std::string & name);
+};
+
+template <typename F>
+void SharedMemoryTransport::waitFor(int peer, F done)
+{
+    Clock::time_point next = Clock::now() + std::chrono::milliseconds(PEER_CHECK_MS);
+    while (!done()) {
+        std::this_thread::yield();
+        if (Clock::now() < next)
+            continue;
+        next = Clock::now() + std::chrono::milliseconds(PEER_CHECK_MS);
+        if (header().stale.load(std::memory_order_acquire)) {
+            broken = true;
+            throw std::runtime_error("shared memory transport: the segment was taken over by another run");
+        }
+        for (int r = 0; r < count; r++) {
+            if (r != myRank && (peer < 0 || r == peer) && !processAlive(join(r).pid.load(std::memory_order_acquire))) {
+                broken = true;
+                throw std::runtime_error("shared memory transport: rank " + std::to_string(r) + " has exited");
+            }
+        }
+    }
+}
+
+template <typename F>
+bool SharedMemoryTransport::waitOpen(Clock::time_point start, F done)
+{
+    Clock::time_point deadline = start + std::chrono::seconds(OPEN_TIMEOUT);
+    Clock::time_point next = Clock::now();
+    while (!done()) {
+        if (Clock::now() > deadline || header().stale.load(std::memory_order_acquire))
+            return false;
+        if (myRank != 0 && Clock::now() >= next) {
+            // rank 0 of a segment left by a crashed run is gone
+            next = Clock::now() + std::chrono::milliseconds(PEER_CHECK_MS);
+            if (!processAlive(join(0).pid.load(std::memory_order_acquire)))
+                return false;
+        }
+        std::this_thread::yield();
+    }
+    return !header().stale.load(std::memory_order_acquire);
+}
+
+bool SharedMemoryTransport::create(const std::string & name)
+{
+    Clock::time_point start = Clock::now();
+    if (!rendezvous.map(name, sizeof(Mailbox), MAP_OPEN_OR_CREATE)) {
+        std::cout << "Unable to create shared memory " << name << std::endl;
+        return false;
+    }
+
+    // ranks still waiting in the segment of an earlier run give up on it
+    uint64_t previous = published().runId.load(std::memory_order_acquire);
+    SharedMapping old;
+    if (previous != 0 && old.map(segmentName(name, previous), sizeof(SegmentHeader), MAP_OPEN)) {
+        ((SegmentHeader *)old.base)->stale.store(1, std::memory_order_release);
+        old.unmap();
+        old.unlink();
+    }
+
+    uint64_t id = makeNonce();
+    if (!segment.map(segmentName(name, id), segmentBytes, MAP_CREATE)) {
+        std::cout << "Unable to create shared memory " << segmentName(name, id) << std::endl;
+        return false;
+    }
+    runId = id;
+    base = segment.base;
+    join(0).pid.store(currentPid(), std::memory_order_relaxed);
+    header().magic.store(SEGMENT_MAGIC, std::memory_order_release);
+    published().runId.store(runId, std::memory_order_release);
+
+    // accept the ranks that joined this segment, until each has
+    for (int r = 1; r < count; r++) {
+        uint64_t nonce = 0;
+        if (!waitOpen(start, [&] { return (nonce = join(r).nonce.load(std::memory_order_acquire)) != 0; })) {
+            std::cout << "Rank " << r << " did not open shared memory " << name << " within " << OPEN_TIMEOUT
+                      << " s" << std::endl;
+            // the ranks that did join give up too
+            header().stale.store(1, std::memory_order_release);
+            return false;
+        }
+        join(r).accepted.store(nonce, std::memory_order_release);
+    }
+    return true;
+}
+
+bool SharedMemoryTransport::attach(const std::string & name)
+{
+    Clock::time_point start = Clock::now();
+    uint64_t nonce = makeNonce();
+    while (Clock::now() - start < std::chrono::seconds(OPEN_TIMEOUT)) {
+        uint64_t id = 0;
+        if (rendezvous.base != NULL || rendezvous.map(name, sizeof(Mailbox), MAP_OPEN))
+            id = published().runId.load(std::memory_order_acquire);
+        if (id != 0 && segment.map(segmentName(name, id), segmentBytes, MAP_OPEN)) {
+            base = segment.base;
+            JoinSlot & mine = join(myRank);
+            if (waitOpen(start, [&] { return header().magic.load(std::memory_order_acquire) == SEGMENT_MAGIC; })) {
+                mine.pid.store(currentPid(), std::memory_order_relaxed);
+                mine.nonce.store(nonce, std::memory_order_release);
+                if (waitOpen(start, [&] { return mine.accepted.load(std::memory_order_acquire) == nonce; })) {
+                    runId = id;
+                    return true;
+                }
+            }
+            // stale or abandoned, rank 0 of this run publishes a segment of its own
+            segment.unmap();
+            base = NULL;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+bool SharedMemoryTransport::open(const std::string & name)
+{
+    // slots start at a cache line, the message size is rounded to keep them there
+    maxBytes = (maxBytes + sizeof(Mailbox) - 1) / sizeof(Mailbox) * sizeof(Mailbox);
+    size_t boxes = (size_t)count * count * TAG_COUNT;
+    segmentBytes = (1 + count + boxes) * sizeof(Mailbox) + boxes * MAILBOX_SLOTS * maxBytes;
+
+    if (myRank == 0 ? !create(name) : !attach(name)) {
+        if (myRank != 0)
+            std::cout << "Unable to open shared memory " << name << std::endl;
+        broken = true;
+        return false;
+    }
+    try {
+        barrier();
+    } catch(std::runtime_error err) {
+        std::cout << err.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+    if (base != NULL && !broken) {
+        try {
+            barrier();
+        } catch(std::runtime_error err) {
+            std::cout << err.what() << std::endl;
+        }
+    }
+    if (myRank == 0 && runId != 0) {
+        // a later run finds no segment to mark stale
+        uint64_t expected = runId;
+        published().runId.compare_exchange_strong(expected, 0);
+        segment.unlink();
+        rendezvous.unlink();
+    }
+    segment.unmap();
+    rendezvous.unmap();
+}
+
+} // namespace
+
+std::unique_ptr<Transport> createSharedMemoryTransport(const std::string & name, int rank, int size, size_t maxBytes)
+{
+    std::unique_ptr<SharedMemoryTransport> transport(new SharedMemoryTransport(rank, size, maxBytes));
+    if (!transport->open(name))
+        return NULL;
+    return std::unique_ptr<Transport>(transport.release());
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free triple buffer of slot indices for one producer and one consumer.
+// The producer fills back() and publishes it, the consumer picks up the most
+// recently published slot with consume() and reads front() until the next one.
+// Neither side ever waits for the other, intermediate frames are dropped.
+class TripleBuffer
+{
+public:
+    int back() const { return backIdx; }
+    int front() const { return frontIdx; }
+
+    // producer: hand over the back slot, get the previous middle slot to fill next
+    void publish()
+    {
+        backIdx = middle.exchange(backIdx | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // consumer: whether a published slot is waiting
+    bool hasFresh() const
+    {
+        return (middle.load(std::memory_order_acquire) & FRESH) != 0;
+    }
+
+    // consumer: swap the front slot with the latest published one, false if none
+    bool consume()
+    {
+        if (!hasFresh())
+            return false;
+        frontIdx = middle.exchange(frontIdx, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+private:
+    static const int FRESH = 4;
+    static const int INDEX_MASK = 3;
+
+    int backIdx = 0;                // owned by the producer
+    std::atomic<int> middle{1};     // shared, FRESH set when published and not consumed
+    int frontIdx = 2;               // owned by the consumer
+};